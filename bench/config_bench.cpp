@@ -0,0 +1,202 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cmath>
+#include "../include/common/sketch_utils.hpp"
+#include "../include/common/synth.hpp"
+#include "../include/common/real_dist.hpp"
+#include "../include/framework/m4/m4.hpp"
+#include "../include/framework/framework_utils.hpp"
+
+using namespace sketch;
+
+#if defined(TEST_MREQ)
+#define METATYPE mReqSketch
+#elif defined(TEST_DD)
+#define METATYPE DDSketch
+#else
+#define METATYPE TDigest
+#endif
+
+void print_usage(char* file) {
+    cout << "usage: " << file << " [<records>] [<memory>]" << endl;
+    cout << endl;
+
+    cout << "Meaning of arguments: " << endl;
+    cout << "    records         items of the synthetic trace, by default"
+         << " 10000000" << endl;
+    cout << "    memory          memory of each sketch in KB, by default 512"
+         << endl;
+}
+
+/// Hash functions per level of every configuration.
+constexpr u32 HASH_NUM = 2;
+
+/// Normalized rank queried for every flow, as in SketchTest.
+constexpr f64 GIVEN_P = 0.5;
+
+/// ALE of a configuration above this many times that of the default one
+/// fails the check. Other level counts change the accuracy, up to 1.3
+/// times on the default trace from 512 KB to 16 MB, so this only catches
+/// a configuration that is broken, not one that is worse.
+constexpr f64 MAX_ALE_RATIO = 2.0;
+
+/// @brief Tiny counters and 2 META levels, level 1 taking the flows of
+///        both default levels 1 and 2.
+struct M4ThreeLevels {
+    static constexpr u32 HASH_NUM = 0;
+    static constexpr f64 TINY_MEM_DIV = 0.03;
+    static constexpr M4Level META_LEVELS[] = {
+        {UINT16_MAX, 0.5, 2, 8, 0.92},
+        {UINT32_MAX, 0.3, 4, 16, 0.04},
+    };
+};
+
+/// @brief Tiny counters and 4 META levels, default level 3 being split
+///        at 2^24.
+struct M4FiveLevels {
+    static constexpr u32 HASH_NUM = 0;
+    static constexpr f64 TINY_MEM_DIV = 0.03;
+    static constexpr M4Level META_LEVELS[] = {
+        {UINT8_MAX, 0.5, 2, 4, 0.55},
+        {UINT16_MAX, 0.5, 2, 8, 0.32},
+        {(1u << 24) - 1, 0.4, 4, 12, 0.06},
+        {UINT32_MAX, 0.3, 4, 16, 0.02},
+    };
+};
+
+/// @brief Time a call and return seconds.
+template <typename F>
+f64 time_s(F fn) {
+    auto start = high_resolution_clock::now();
+    fn();
+    auto end = high_resolution_clock::now();
+    return duration_cast<nanoseconds>(end - start).count() / 1e9;
+}
+
+/// @brief What one configuration of M4 made of a trace.
+struct Outcome {
+    f64 ALE = 0;            ///< Over MID and HUGE flows of the trace.
+    f64 APE = 0;            ///< Over MID and HUGE flows of the trace.
+    f64 append_mops = 0;
+    f64 query_mqps = 0;
+    u64 types[3] = {};      ///< Flows M4 calls TINY, MID and HUGE.
+    vec_u32 answers;        ///< Median of every flow, in real.flows(),
+                            ///< 0 for the flows M4 calls TINY.
+};
+
+/// @brief Fill M4 over a configuration with the trace, then query the
+///        median of every flow.
+template <typename CONFIG>
+Outcome run_config(const vector<FlowItem>& trace, const real_dist& real,
+                   u64 mem_limit) {
+    Outcome res;
+    M4<METATYPE, CONFIG> m4(mem_limit, HASH_NUM);
+    f64 sec = time_s([&] {
+        for (const FlowItem& item : trace) {
+            m4.append(item.id, item.value);
+        }
+    });
+    res.append_mops = trace.size() / sec / 1e6;
+
+    // M4 answers no quantile of a flow it keeps in the tiny counters,
+    // so those flows answer 0, as a missing flow would.
+    const vec_u32& flows = real.flows();
+    vec_u32 queried;
+    for (u64 i = 0; i < flows.size(); ++i) {
+        const FlowType type = m4.type(flows[i]);
+        ++res.types[type == TINY ? 0 : type == MID ? 1 : 2];
+        if (type != TINY) {
+            queried.push_back(i);
+        }
+    }
+    res.answers.assign(flows.size(), 0);
+    sec = time_s([&] {
+        for (u32 i : queried) {
+            res.answers[i] = m4.quantile(flows[i], GIVEN_P);
+        }
+    });
+    res.query_mqps = queried.size() / sec / 1e6;
+
+    u64 flow_cnt = 0;
+    for (u64 i = 0; i < flows.size(); ++i) {
+        const u32 id = flows[i];
+        if ((real.type(id) & (MID | HUGE)) == 0 || res.answers[i] == 0) {
+            continue;
+        }
+        const f64 quan = res.answers[i];
+        res.ALE += std::fabs(std::log2(quan / real.quantile(id, GIVEN_P)));
+        res.APE += std::fabs(real.nomRank(id, quan) - GIVEN_P);
+        ++flow_cnt;
+    }
+    res.ALE /= std::max<u64>(1, flow_cnt);
+    res.APE /= std::max<u64>(1, flow_cnt);
+    return res;
+}
+
+void print_row(const string& name, u32 levels, const string& hash,
+               const Outcome& res, const string& check) {
+    cout << std::left << std::setw(16) << name << std::right
+         << std::setw(7) << levels << std::setw(9) << hash
+         << std::fixed << std::setprecision(4)
+         << std::setw(9) << res.ALE << std::setw(9) << res.APE
+         << std::setprecision(2) << std::setw(10) << res.append_mops
+         << std::setw(10) << res.query_mqps
+         << std::setw(9) << res.types[1] << std::setw(9) << res.types[2]
+         << "  " << check << endl;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 3) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    SynthConfig config;
+    config.items = argc >= 2 ? std::stoull(argv[1]) : 10000000;
+    u64 mem_limit = (argc == 3 ? std::stoull(argv[2]) : 512) * 1024;
+
+    const vector<FlowItem> trace = generate_trace(config);
+    real_dist real;
+    real.append(trace.data(), trace.data() + trace.size());
+    real.build();
+
+    using Fixed = M4FixedHash<M4Config, HASH_NUM>;
+    using Three = M4FixedHash<M4ThreeLevels, HASH_NUM>;
+    using Five = M4FixedHash<M4FiveLevels, HASH_NUM>;
+    const Outcome base = run_config<M4Config>(trace, real, mem_limit);
+    const Outcome fixed = run_config<Fixed>(trace, real, mem_limit);
+    const Outcome three = run_config<Three>(trace, real, mem_limit);
+    const Outcome five = run_config<Five>(trace, real, mem_limit);
+
+    // A fixed hash number only unrolls loops, so it must answer every
+    // flow as the default does. Other level counts must stay usable.
+    u32 failed = 0;
+    auto check_same = [&](const Outcome& res) {
+        const bool ok = res.answers == base.answers;
+        failed += !ok;
+        return ok ? string("same answers") : string("ANSWERS DIFFER");
+    };
+    auto check_close = [&](const Outcome& res) {
+        const bool ok = res.ALE <= MAX_ALE_RATIO * base.ALE;
+        failed += !ok;
+        return ok ? string("ok") : string("FAILED");
+    };
+
+    cout << MetaTraits<METATYPE>::name << ", " << real.flows().size()
+         << " flows, " << mem_limit / 1024 << " KB" << endl;
+    cout << std::left << std::setw(16) << "config" << std::right
+         << std::setw(7) << "levels" << std::setw(9) << "hash"
+         << std::setw(9) << "ALE" << std::setw(9) << "APE"
+         << std::setw(10) << "app Mops" << std::setw(10) << "q Mq/s"
+         << std::setw(9) << "MID" << std::setw(9) << "HUGE" << endl;
+    print_row("default", 4, "runtime", base, "");
+    print_row("default", 4, "fixed", fixed, check_same(fixed));
+    print_row("three levels", 3, "fixed", three, check_close(three));
+    print_row("five levels", 5, "fixed", five, check_close(five));
+
+    if (failed > 0) {
+        cerr << failed << " configuration check(s) failed" << endl;
+        return 1;
+    }
+}
@@ -0,0 +1,243 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <thread>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+#include "../include/common/sketch_utils.hpp"
+#include "../include/common/dataset.hpp"
+
+using namespace sketch;
+
+void print_usage(char* file) {
+    cout << "usage: " << file << " [<records>] [<dir>] [<threads>]" << endl;
+    cout << endl;
+
+    cout << "Meaning of arguments: " << endl;
+    cout << "    records         records per synthetic trace, by default"
+         << " 10000000" << endl;
+    cout << "    dir             directory for synthetic traces, by default"
+         << " /tmp" << endl;
+    cout << "    threads         decoding threads compared with 1, by default"
+         << " all cores" << endl;
+}
+
+const char* format_name(TraceFormat format) {
+    switch (format) {
+    case CAIDA_TRACE:
+        return "caida";
+    case IMC_TRACE:
+        return "imc";
+    default:
+        return "MAWI";
+    }
+}
+
+/// @brief Write a synthetic trace with the record layout of a format.
+/// @details Keys are skewed over 2^16 flows and timestamps increase by
+///          a few microseconds per record, in the unit of the format.
+void write_trace(const string& path, TraceFormat format, u64 records) {
+    FILE* pf = fopen(path.c_str(), "wb");
+    if (!pf) {
+        throw std::runtime_error("cannot create " + path);
+    }
+    rand_u32_generator gen(1);
+    char rec[32] = {0};
+    const u32 stride = record_size(format);
+    f64 sec = 1.5e9;
+    long long tick = 1500000000000LL;
+    for (u64 i = 0; i < records; ++i) {
+        u32 r = gen();
+        u32 key = (r & 0xffff) >> (r >> 28);
+        std::memcpy(rec, &key, sizeof(key));
+        if (format == CAIDA_TRACE) {
+            sec += (r >> 20 & 7) * 1e-6;
+            std::memcpy(rec + 13, &sec, sizeof(sec));
+        } else {
+            tick += r >> 20 & 7;
+            std::memcpy(rec + (format == IMC_TRACE ? 18 : 13), &tick,
+                        sizeof(tick));
+        }
+        fwrite(rec, 1, stride, pf);
+    }
+    fclose(pf);
+}
+
+/// @brief The former loader, reading one record per fread call.
+vector<FlowItem> fread_trace(const char* filename, TraceFormat format) {
+    FILE* pf = fopen(filename, "rb");
+    if (!pf) {
+        throw std::runtime_error("cannot open file");
+    }
+    vector<FlowItem> vec;
+    double ftime = -1;
+    long long fime = -1;
+    char trace[30];
+    if (format == CAIDA_TRACE) {
+        while (fread(trace, 1, 21, pf)) {
+            u32 tkey = *(u32*) (trace);
+            double ttime = *(double*) (trace + 13);
+            if (ftime < 0) ftime = ttime;
+            vec.push_back({tkey, u32((ttime - ftime) * 10000000) + 1});
+        }
+    } else if (format == IMC_TRACE) {
+        while (fread(trace, 1, 26, pf)) {
+            u32 tkey = *(u32*) (trace);
+            long long ttime = *(long long*) (trace + 18);
+            if (fime < 0) fime = ttime;
+            vec.push_back({tkey, u32((ttime - fime) / 100) + 1});
+        }
+    } else {
+        while (fread(trace, 1, 21, pf)) {
+            u32 tkey = *(u32*) (trace);
+            long long ttime = *(long long*) (trace + 13);
+            if (fime < 0) fime = ttime;
+            vec.push_back({tkey, u32((ttime - fime) * 100000) + 1});
+        }
+    }
+    fclose(pf);
+    return vec;
+}
+
+/// @brief The former inter-arrival stage, on a node-based hash map.
+void map_inter_arrival(vector<FlowItem>& items) {
+    std::unordered_map<u32, u32> mp;
+    for (auto& [key, value]: items) {
+        u32 temp = value;
+        value = std::max(1u, value - mp[key]);
+        mp[key] = temp;
+    }
+}
+
+/// @brief Time a call and return seconds.
+template <typename F>
+f64 time_s(F fn) {
+    auto start = high_resolution_clock::now();
+    fn();
+    auto end = high_resolution_clock::now();
+    return duration_cast<nanoseconds>(end - start).count() / 1e9;
+}
+
+void print_row(const string& format, const string& impl, u64 records,
+               f64 sec, f64 base) {
+    cout << std::left << std::setw(8) << format << std::setw(18) << impl
+         << std::right << std::fixed << std::setprecision(1)
+         << std::setw(9) << sec * 1e3 << " ms" << std::setw(9)
+         << records / sec / 1e6 << " Mrec/s" << std::setprecision(2)
+         << std::setw(8) << base / sec << "x" << endl;
+}
+
+bool same_items(const vector<FlowItem>& a, const vector<FlowItem>& b) {
+    return a.size() == b.size()
+        && std::equal(a.begin(), a.end(), b.begin(),
+                      [](const FlowItem& x, const FlowItem& y) {
+                          return x.id == y.id && x.value == y.value;
+                      });
+}
+
+void run_format(TraceFormat format, u64 records, const string& dir,
+                u32 threads) {
+    const string name = format_name(format);
+    const string path = dir + "/m4_load_bench_" + name + ".dat";
+    write_trace(path, format, records);
+
+    vector<FlowItem> ref, res;
+    f64 base = time_s([&] { ref = fread_trace(path.c_str(), format); });
+    print_row(name, "fread", records, base, base);
+
+    vec_u32 thread_nums = {1};
+    if (threads > 1) {
+        thread_nums.push_back(threads);
+    }
+    for (u32 t : thread_nums) {
+        f64 sec = time_s([&] {
+            res = parse_trace(path.c_str(), format, t);
+        });
+        if (!same_items(ref, res)) {
+            cerr << name << " parse_trace mismatch" << endl;
+        }
+        print_row(name, "mmap " + std::to_string(t) + " thread",
+                  records, sec, base);
+    }
+
+    const f64 parse_base = base;
+    vector<FlowItem> ref_delta = ref;
+    base = time_s([&] { map_inter_arrival(ref_delta); });
+    print_row(name, "delta unordered", records, base, base);
+    for (u32 t : thread_nums) {
+        vector<FlowItem> delta = ref;
+        f64 sec = time_s([&] { to_inter_arrival(delta, t); });
+        if (!same_items(ref_delta, delta)) {
+            cerr << name << " to_inter_arrival mismatch" << endl;
+        }
+        print_row(name, "delta " + std::to_string(t) + " thread",
+                  records, sec, base);
+    }
+
+    // the cache replaces both stages above on later runs
+    base += parse_base;
+    const string cache = path + ".m4c";
+    write_cache(cache.c_str(), ref_delta);
+    detail::MappedFile cache_file(cache.c_str());
+    for (u32 t : thread_nums) {
+        f64 sec = time_s([&] { res = read_cache(cache.c_str(), t); });
+        if (!same_items(ref_delta, res)) {
+            cerr << name << " read_cache mismatch" << endl;
+        }
+        print_row(name, "cache " + std::to_string(t) + " thread",
+                  records, sec, base);
+    }
+    cout << name << " cache is " << std::setprecision(1)
+         << 100.0 * cache_file.size() / (records * record_size(format))
+         << "% of the trace" << endl;
+
+    std::remove(cache.c_str());
+    std::remove(path.c_str());
+}
+
+void run_synth(u64 records, u32 threads) {
+    SynthConfig config;
+    config.items = records;
+
+    // The parts of a whole trace: building the tables, and the generator
+    // loop alone, writing into a buffer that is already faulted in.
+    f64 table_sec = time_s([&] { SynthTrace trace(config); });
+    const SynthTrace trace(config);
+    vector<FlowItem> buf(records);
+    f64 loop_sec = time_s([&] { trace.generate(0, records, buf.data()); });
+
+    vec_u32 thread_nums = {1};
+    if (threads > 1) {
+        thread_nums.push_back(threads);
+    }
+    f64 base = 0;
+    for (u32 t : thread_nums) {
+        f64 sec = time_s([&] { generate_trace(config, t); });
+        if (base == 0) {
+            base = sec;
+            print_row("synth", "build tables", records, table_sec, base);
+            print_row("synth", "generate loop", records, loop_sec, base);
+        }
+        print_row("synth", "trace " + std::to_string(t) + " thread",
+                  records, sec, base);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 4) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    u64 records = argc >= 2 ? std::stoull(argv[1]) : 10000000;
+    string dir = argc >= 3 ? argv[2] : "/tmp";
+    u32 threads = argc == 4 ? std::stoul(argv[3])
+                : std::max(1u, std::thread::hardware_concurrency());
+
+    // traces are timed right after being written, i.e. from page cache
+    for (u32 f = 0; f < NUM_TRACE_FORMATS; ++f) {
+        run_format(static_cast<TraceFormat>(f), records, dir, threads);
+    }
+    run_synth(records, threads);
+}
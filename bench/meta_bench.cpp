@@ -0,0 +1,421 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include "../include/common/sketch_utils.hpp"
+#include "../include/common/synth.hpp"
+#include "../include/common/BOBHash32.h"
+#include "../include/common/tiny_counter.hpp"
+#include "../include/common/histogram.hpp"
+#include "../include/common/sorted_view.hpp"
+#include "../include/meta/dd/ddsketch.hpp"
+#include "../include/meta/mreq/mreq_sketch.hpp"
+#include "../include/meta/tdigest/tdigest.hpp"
+
+using namespace sketch;
+
+void print_usage(char* file) {
+    cout << "usage: " << file << " [<dist>] [<capacity>] [<rounds>]" << endl;
+    cout << endl;
+
+    cout << "Meaning of arguments: " << endl;
+    cout << "    dist            value distribution, exp, lognormal or"
+         << " bimodal, by default all" << endl;
+    cout << "    capacity        items per META, by default those of M4"
+         << " levels 1 to 3" << endl;
+    cout << "    rounds          measurements per operation, by default 10"
+         << endl;
+}
+
+/// Values drawn per distribution, and operations per measurement.
+constexpr u32 BATCH = 1 << 16;
+/// Operations per measurement of the slower operations.
+constexpr u32 SLOW_BATCH = 1 << 12;
+/// Number of filled METAs queried in turn.
+constexpr u32 POOL = 64;
+/// Most items filled into a META of unbounded capacity.
+constexpr u32 MAX_FILL = 1 << 16;
+
+/// @brief META parameters of a level, as in M4.
+struct Level {
+    string name;
+    u32 cap;
+    f64 alpha;      ///< Of DDSketch.
+    u32 cmtorCap;   ///< Of mReqSketch.
+    u32 delta;      ///< Of TDigest.
+};
+
+const Level LEVELS[] = {
+    {"L1", UINT8_MAX, 0.5, 2, 4},
+    {"L2", UINT16_MAX, 0.5, 2, 8},
+    {"L3", UINT32_MAX, 0.3, 4, 16},
+};
+
+/// @brief Mean and standard deviation of ns per operation.
+struct Stat {
+    f64 mean;
+    f64 stddev;
+};
+
+/// @brief Measure an operation @c rounds times after a warm-up round.
+/// @param setup Called before each measurement, untimed.
+/// @param run Called once per measurement, running @c ops operations.
+template <typename Setup, typename Run>
+Stat measure(u32 rounds, u64 ops, Setup setup, Run run) {
+    vec_f64 ns;
+    for (u32 r = 0; r <= rounds; ++r) {
+        setup();
+        auto start = high_resolution_clock::now();
+        run();
+        auto end = high_resolution_clock::now();
+        if (r > 0) {
+            ns.push_back(duration_cast<nanoseconds>(end - start).count()
+                         / static_cast<f64>(ops));
+        }
+    }
+    f64 mean = 0, var = 0;
+    for (f64 x : ns) {
+        mean += x;
+    }
+    mean /= ns.size();
+    for (f64 x : ns) {
+        var += (x - mean) * (x - mean);
+    }
+    var /= std::max<u64>(1, ns.size() - 1);
+    return {mean, std::sqrt(var)};
+}
+
+void print_row(const string& op, const string& level, const Stat& s) {
+    cout << std::left << std::setw(20) << op << std::setw(6) << level
+         << std::right << std::fixed << std::setprecision(2)
+         << std::setw(10) << s.mean << " ns  +- " << std::setw(8)
+         << s.stddev << std::setw(8) << std::setprecision(1)
+         << 100 * s.stddev / s.mean << "%" << endl;
+}
+
+volatile u32 sink = 0;  // just for avoiding optimization
+
+/// @brief Time the operations that do not depend on values.
+void run_common(u32 rounds) {
+    vec_u32 ids;
+    rand_u32_generator gen(1);
+    for (u32 i = 0; i < BATCH; ++i) {
+        ids.push_back(gen());
+    }
+
+    BOBHash32 hash(1);
+    print_row("BOBHash32::run", "", measure(rounds, BATCH, [] {}, [&] {
+        u32 h = 0;
+        for (u32 id : ids) {
+            h ^= hash.run(id);
+        }
+        sink = h;
+    }));
+
+    // each counter takes MAX_CNT items at each of its 4 indices
+    constexpr u32 PER_CNTER = 12;
+    vector<TinyCnter> cnters;
+    print_row("TinyCnter::append", "", measure(rounds,
+        BATCH / PER_CNTER * PER_CNTER,
+        [&] { cnters.assign(BATCH / PER_CNTER, TinyCnter()); },
+        [&] {
+            for (u32 k = 0; k < cnters.size(); ++k) {
+                for (u32 j = 0; j < PER_CNTER; ++j) {
+                    cnters[k].append(ids[k + j], j / 3);
+                }
+            }
+        }));
+}
+
+/// @brief Time appends filling @c fill items into each of a batch of
+///        fresh METAs.
+template <typename S>
+Stat time_append(u32 rounds, const S& empty, u32 fill, const vec_u32& vals) {
+    const u32 num = std::max(1u, BATCH / fill);
+    vector<S> sketches;
+    return measure(rounds, static_cast<u64>(num) * fill,
+        [&] { sketches.assign(num, empty); },
+        [&] {
+            for (u32 k = 0; k < num; ++k) {
+                for (u32 j = 0; j < fill; ++j) {
+                    sketches[k].append(vals[(k * fill + j) % vals.size()]);
+                }
+            }
+        });
+}
+
+/// @brief Return POOL METAs, each filled with its own @c fill items.
+template <typename S>
+vector<S> fill_pool(const S& empty, u32 fill, const vec_u32& vals) {
+    vector<S> pool(POOL, empty);
+    for (u32 k = 0; k < POOL; ++k) {
+        for (u32 j = 0; j < fill; ++j) {
+            pool[k].append(vals[(k * 7919 + j) % vals.size()]);
+        }
+    }
+    return pool;
+}
+
+/// @brief Time quantiles of random ranks over a pool of METAs, after
+///        one query each has built their caches.
+template <typename S>
+Stat time_quantile(u32 rounds, const vector<S>& pool, const vec_f64& ranks) {
+    for (const S& s : pool) {
+        sink = s.quantile(0.5);
+    }
+    return measure(rounds, BATCH, [] {}, [&] {
+        u32 q = 0;
+        for (u32 i = 0; i < BATCH; ++i) {
+            q ^= pool[i % POOL].quantile(ranks[i % ranks.size()]);
+        }
+        sink = q;
+    });
+}
+
+/// @brief Time compacting full compactors into half-full next ones.
+Stat time_compact(u32 rounds, u32 cmtor_cap, const vec_u32& vals) {
+    const u32 width = 2 * cmtor_cap;
+    vec_u32 items(static_cast<u64>(BATCH) * width);
+    vector<mReqCmtor> cur(BATCH), next(BATCH);
+    rand_bit_generator coin(1);
+    auto setup = [&] {
+        for (u32 k = 0; k < BATCH; ++k) {
+            u32* base = items.data() + static_cast<u64>(k) * width;
+            cur[k] = mReqCmtor(0, cmtor_cap, 0);
+            next[k] = mReqCmtor(1, cmtor_cap, cmtor_cap);
+            for (u32 j = 0; j < cmtor_cap; ++j) {
+                cur[k].append(base, vals[(k * width + j) % vals.size()]);
+            }
+            vec_u32 kept;
+            for (u32 j = 0; j < cmtor_cap / 2; ++j) {
+                kept.push_back(vals[(k * width + cmtor_cap + j)
+                                    % vals.size()]);
+            }
+            std::sort(kept.begin(), kept.end());
+            for (u32 v : kept) {
+                next[k].append(base, v);
+            }
+        }
+    };
+    return measure(rounds, BATCH, setup, [&] {
+        for (u32 k = 0; k < BATCH; ++k) {
+            cur[k].compact(items.data() + static_cast<u64>(k) * width,
+                           next[k], coin);
+        }
+    });
+}
+
+/// @brief Time building cumulative views from the compactors of an
+///        mReqSketch holding @c fill items, as a query does.
+Stat time_view(u32 rounds, u32 fill, u32 cmtor_cap, const vec_u32& vals) {
+    const u32 cmtor_num = std::ceil(
+        std::log2(static_cast<f64>(fill) / cmtor_cap + 1));
+    const u32 num = cmtor_num * cmtor_cap;
+    return measure(rounds, SLOW_BATCH, [] {}, [&] {
+        u32 q = 0;
+        for (u32 k = 0; k < SLOW_BATCH; ++k) {
+            const u32* first = vals.data() + (k * num) % (vals.size() - num);
+            SortedView view(num + 2);
+            for (u32 i = 0; i < cmtor_num; ++i) {
+                view.insert(first + i * cmtor_cap,
+                            first + (i + 1) * cmtor_cap, 1 << i);
+            }
+            view.insert(0, 0);
+            view.insert(UINT32_MAX, 0);
+            view.convertToCumulative();
+            q ^= view.quantile(0.5);
+        }
+        sink = q;
+    });
+}
+
+/// @brief Time appends that flush the buffer of a t-digest, i.e. merge
+///        and compressNearest, which are private.
+Stat time_flush(u32 rounds, const Level& lv, u32 fill, const vec_u32& vals) {
+    // Fill to one item short of a flush, keeping clear of the capacity
+    // so that flushes only happen every delta items.
+    const u32 room = std::min<u64>(fill, lv.cap - 2 * lv.delta);
+    const u32 prefill = std::max(lv.delta, room / lv.delta * lv.delta) - 1;
+    const vector<TDigest> pool = fill_pool(TDigest(lv.cap, lv.delta),
+                                           prefill, vals);
+    vector<TDigest> digests;
+    return measure(rounds, SLOW_BATCH,
+        [&] {
+            digests.clear();
+            for (u32 k = 0; k < SLOW_BATCH; ++k) {
+                digests.push_back(pool[k % POOL]);
+            }
+        },
+        [&] {
+            for (u32 k = 0; k < SLOW_BATCH; ++k) {
+                digests[k].append(vals[k]);
+            }
+        });
+}
+
+/// @brief Check the histogram of a META holding @c fill values in
+///        [base, base + 4096), the least of which is @c base.
+/// @return Number of failed checks, each reported.
+template <typename S>
+u32 check_large(const string& meta, const Level& lv, const S& empty,
+                u32 base, u32 fill) {
+    u32 failed = 0;
+    auto fail = [&](const string& what) {
+        cerr << meta << " " << lv.name << " with " << fill << " items from "
+             << base << ": " << what << endl;
+        ++failed;
+    };
+    rand_u32_generator gen(base, 4095);
+    // the base itself is odd, so f32 does not hold the minimum
+    S a = empty, b = empty;
+    a.append(base);
+    b.append(base);
+    u32 lo = base, hi = base;
+    for (u32 i = 1; i < fill; ++i) {
+        u32 x = base + gen(), y = base + gen();
+        a.append(x);
+        b.append(y);
+        lo = std::min({lo, x, y});
+        hi = std::max({hi, x, y});
+    }
+
+    const Histogram ha = static_cast<Histogram>(a);
+    const vec_f64 split = ha.splitPoints();
+    if (!std::is_sorted(split.begin(), split.end())) {
+        fail("unsorted split points");
+    }
+    for (f64 rank : {0.0, 0.5, 1.0}) {
+        const f64 q = a.quantile(rank);
+        if (q + 1 < lo || q > hi + 1.0) {
+            fail("quantile " + std::to_string(rank) + " out of range");
+        }
+    }
+    const vec_u32 heights = (ha & static_cast<Histogram>(b)).heights();
+    if (std::all_of(heights.begin(), heights.end(),
+                    [](u32 h) { return h == 0; })) {
+        fail("minimum of two sketches is empty");
+    }
+    return failed;
+}
+
+/// @brief Check the histograms of METAs keeping sampled values, which
+///        hold values above 2^24 that f32 does not hold exactly.
+/// @details Values lie in [base, base + 4096), for odd bases just above
+///          2^24 and near the top of u32, and fills from 2 items, where
+///          outer centroids hold one item, to the capacity. Split points
+///          must be sorted, quantiles must stay within one of the values
+///          and the minimum of two METAs must not be empty.
+/// @return Number of failed checks, each reported.
+template <typename S>
+u32 check_large(const string& meta, const Level& lv, const S& empty) {
+    u32 failed = 0;
+    for (u32 base : {(1u << 24) + 1, UINT32_MAX - 8192}) {
+        for (u32 fill : {2u, 64u, std::min(lv.cap, 4096u)}) {
+            failed += check_large(meta, lv, empty, base, fill);
+        }
+    }
+    return failed;
+}
+
+void run_level(const Level& lv, u32 fill, u32 rounds, const vec_u32& vals) {
+    vec_f64 ranks;
+    rand_u32_generator gen(2, 1000000);
+    for (u32 i = 0; i < 256; ++i) {
+        ranks.push_back(gen() / 1e6);
+    }
+
+    const DDSketch dd(lv.cap, lv.alpha);
+    print_row("dd append", lv.name, time_append(rounds, dd, fill, vals));
+    const vector<DDSketch> dds = fill_pool(dd, fill, vals);
+    print_row("dd quantile", lv.name, time_quantile(rounds, dds, ranks));
+
+    vector<Histogram> hists(dds.begin(), dds.end());
+    print_row("Histogram &", lv.name, measure(rounds, SLOW_BATCH, [] {}, [&] {
+        u32 q = 0;
+        for (u32 i = 0; i < SLOW_BATCH; ++i) {
+            q ^= (hists[i % POOL] & hists[(i + 1) % POOL]).quantile(0.5);
+        }
+        sink = q;
+    }));
+    print_row("Histogram |", lv.name, measure(rounds, SLOW_BATCH, [] {}, [&] {
+        u32 q = 0;
+        for (u32 i = 0; i < SLOW_BATCH; ++i) {
+            q ^= (hists[i % POOL] | hists[(i + 1) % POOL]).quantile(0.5);
+        }
+        sink = q;
+    }));
+    print_row("Histogram quantile", lv.name, time_quantile(rounds, hists,
+                                                           ranks));
+
+    const mReqSketch mreq(lv.cap, lv.cmtorCap, 1);
+    print_row("mreq append", lv.name, time_append(rounds, mreq, fill, vals));
+    print_row("mreq quantile", lv.name,
+              time_quantile(rounds, fill_pool(mreq, fill, vals), ranks));
+    print_row("mreq compact", lv.name, time_compact(rounds, lv.cmtorCap,
+                                                    vals));
+    print_row("SortedView build", lv.name,
+              time_view(rounds, fill, lv.cmtorCap, vals));
+
+    const TDigest td(lv.cap, lv.delta);
+    print_row("td append", lv.name, time_append(rounds, td, fill, vals));
+    print_row("td quantile", lv.name,
+              time_quantile(rounds, fill_pool(td, fill, vals), ranks));
+    print_row("td flush", lv.name, time_flush(rounds, lv, fill, vals));
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 4) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    vector<string> dists = {"exp", "lognormal", "bimodal"};
+    if (argc >= 2 && string(argv[1]) != "all") {
+        dists = {argv[1]};
+    }
+    const u32 capacity = argc >= 3 ? std::stoul(argv[2]) : 0;
+    const u32 rounds = argc == 4 ? std::stoul(argv[3]) : 10;
+    if (rounds == 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // a given capacity takes the parameters of the first level holding it
+    vector<std::pair<Level, u32>> levels;
+    for (const Level& lv : LEVELS) {
+        if (capacity == 0) {
+            levels.push_back({lv, std::min(lv.cap, MAX_FILL)});
+        } else if (capacity <= lv.cap) {
+            levels.push_back({lv, capacity});
+            break;
+        }
+    }
+
+    u32 failed = 0;
+    for (const Level& lv : LEVELS) {
+        failed += check_large("mreq", lv, mReqSketch(lv.cap, lv.cmtorCap, 1));
+        failed += check_large("td", lv, TDigest(lv.cap, lv.delta));
+    }
+    if (failed != 0) {
+        cerr << failed << " checks on values above 2^24 failed" << endl;
+        return 1;
+    }
+
+    cout << "common" << endl;
+    run_common(rounds);
+    for (const string& dist : dists) {
+        SynthConfig config = parse_synth("dist=" + dist);
+        config.items = BATCH;
+        config.flows = 1;
+        vec_u32 vals;
+        for (const FlowItem& item : generate_trace(config)) {
+            vals.push_back(item.value);
+        }
+
+        cout << endl << dist << endl;
+        for (const auto& [lv, fill] : levels) {
+            run_level(lv, fill, rounds, vals);
+        }
+    }
+}
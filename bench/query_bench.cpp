@@ -0,0 +1,144 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <thread>
+#include <algorithm>
+#include "../include/common/sketch_utils.hpp"
+#include "../include/common/synth.hpp"
+#include "../include/common/parallel.hpp"
+#include "../include/framework/m4/m4.hpp"
+#include "../include/framework/strawman/strawman.hpp"
+#include "../include/framework/framework_utils.hpp"
+
+using namespace sketch;
+
+#if defined(TEST_MREQ)
+#define METATYPE mReqSketch
+#elif defined(TEST_DD)
+#define METATYPE DDSketch
+#else
+#define METATYPE TDigest
+#endif
+
+void print_usage(char* file) {
+    cout << "usage: " << file << " [<records>] [<threads>] [<memory>]"
+         << endl;
+    cout << endl;
+
+    cout << "Meaning of arguments: " << endl;
+    cout << "    records         items of the synthetic trace, by default"
+         << " 10000000" << endl;
+    cout << "    threads         most reader threads, by default all cores"
+         << endl;
+    cout << "    memory          memory of each sketch in KB, by default 512"
+         << endl;
+}
+
+/// Passes over all flows per measurement.
+constexpr u32 ROUNDS = 5;
+
+/// @brief Time a call and return seconds.
+template <typename F>
+f64 time_s(F fn) {
+    auto start = high_resolution_clock::now();
+    fn();
+    auto end = high_resolution_clock::now();
+    return duration_cast<nanoseconds>(end - start).count() / 1e9;
+}
+
+/// @brief Query all flows ROUNDS times on 1, 2, 4, ... and at last
+///        @c max_threads reader threads sharing one sketch, and check
+///        the answers against single-threaded ones.
+template <typename S>
+void run_model(const string& name, const S& sketch, const vec_u32& ids,
+               u32 max_threads) {
+    // the first pass builds the lazy caches of the METAs
+    vec_u32 expect(ids.size());
+    f64 cold = time_s([&] {
+        for (u64 i = 0; i < ids.size(); ++i) {
+            expect[i] = sketch.quantile(ids[i], 0.5);
+        }
+    });
+    cout << std::left << std::setw(10) << name << std::setw(14) << "cold"
+         << std::right << std::fixed << std::setprecision(2)
+         << std::setw(9) << ids.size() / cold / 1e6 << " Mq/s" << endl;
+
+    vec_u32 thread_nums;
+    for (u32 t = 1; t < max_threads; t *= 2) {
+        thread_nums.push_back(t);
+    }
+    thread_nums.push_back(max_threads);
+
+    f64 base = 0;
+    for (u32 t : thread_nums) {
+        vector<u8> wrong(t, 0);
+        const u64 share = (ids.size() + t - 1) / t;
+        f64 sec = time_s([&] {
+            detail::run_threads(t, [&](u32 k) {
+                const u64 first = std::min<u64>(ids.size(), k * share);
+                const u64 last = std::min<u64>(ids.size(), first + share);
+                for (u32 r = 0; r < ROUNDS; ++r) {
+                    for (u64 i = first; i < last; ++i) {
+                        if (sketch.quantile(ids[i], 0.5) != expect[i]) {
+                            wrong[k] = 1;
+                        }
+                    }
+                }
+            });
+        });
+        if (std::find(wrong.begin(), wrong.end(), 1) != wrong.end()) {
+            cerr << name << " answers differ on " << t << " threads"
+                 << endl;
+        }
+        const f64 mqps = ROUNDS * ids.size() / sec / 1e6;
+        if (base == 0) {
+            base = mqps;
+        }
+        cout << std::left << std::setw(10) << name
+             << std::setw(14) << std::to_string(t) + " thread"
+             << std::right << std::setw(9) << mqps << " Mq/s"
+             << std::setw(8) << mqps / base << "x" << endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 4) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    SynthConfig config;
+    config.items = argc >= 2 ? std::stoull(argv[1]) : 10000000;
+    u32 threads = argc >= 3 ? std::stoul(argv[2])
+                : std::max(1u, std::thread::hardware_concurrency());
+    u64 mem_limit = (argc == 4 ? std::stoull(argv[3]) : 512) * 1024;
+
+    const vector<FlowItem> trace = generate_trace(config);
+    M4<METATYPE> m4(mem_limit);
+    Strawman<METATYPE> straw(mem_limit);
+    for (const FlowItem& item : trace) {
+        m4.append(item.id, item.value);
+        straw.append(item.id, item.value);
+    }
+
+    // flows M4 can answer, i.e. those out of the tiny counters
+    vec_u32 ids;
+    ids.reserve(trace.size());
+    for (const FlowItem& item : trace) {
+        ids.push_back(item.id);
+    }
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    ids.erase(std::remove_if(ids.begin(), ids.end(), [&](u32 id) {
+                  return m4.type(id) == TINY;
+              }), ids.end());
+    // a random order, as flows are looked up in practice
+    rand_u32_generator gen(1);
+    for (u64 i = ids.size(); i > 1; --i) {
+        std::swap(ids[i - 1], ids[gen() % i]);
+    }
+
+    cout << MetaTraits<METATYPE>::name << ", " << ids.size() << " flows" << endl;
+    run_model("m4", m4, ids, threads);
+    run_model("strawman", straw, ids, threads);
+}
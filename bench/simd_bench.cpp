@@ -0,0 +1,273 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <algorithm>
+#include <iterator>
+#include "../include/common/sketch_utils.hpp"
+#include "../include/common/simd_kernels.hpp"
+
+using namespace sketch;
+
+void print_usage(char* file) {
+    cout << "usage: " << file << " [<size>] [<rounds>]" << endl;
+    cout << endl;
+
+    cout << "Meaning of arguments: " << endl;
+    cout << "    size            array length, by default 8, 32, 128 and 1024"
+         << endl;
+    cout << "    rounds          kernel calls per measurement, by default 200000"
+         << endl;
+}
+
+/// Number of distinct inputs cycled through, so that branch predictors
+/// cannot learn a single input by heart.
+constexpr u32 POOL = 1024;
+
+/// @brief Sorted arrays shared by all kernels of one size.
+struct bench_input {
+    vec_f64 f1, f2;
+    vec_u32 u1, u2;
+    vec_u32 keys;
+};
+
+bench_input make_input(u32 size, u32 seed) {
+    bench_input in;
+    rand_u32_generator gen(seed, 4 * size);
+    for (u32 i = 0; i < size; ++i) {
+        in.u1.push_back(gen());
+        in.u2.push_back(gen());
+    }
+    std::sort(in.u1.begin(), in.u1.end());
+    std::sort(in.u2.begin(), in.u2.end());
+    // half of the split points are shared, as in histogram merges
+    for (u32 i = 0; i < size; ++i) {
+        in.f1.push_back(in.u1[i]);
+        in.f2.push_back(i % 2 ? in.u1[i] : in.u2[i]);
+    }
+    std::sort(in.f2.begin(), in.f2.end());
+    for (u32 i = 0; i < 256; ++i) {
+        in.keys.push_back(gen());
+    }
+    return in;
+}
+
+/// @brief Time @c rounds calls of @c fn and return ns per call.
+template <typename F>
+f64 time_ns(u32 rounds, F fn) {
+    auto start = high_resolution_clock::now();
+    for (u32 i = 0; i < rounds; ++i) {
+        fn(i);
+    }
+    auto end = high_resolution_clock::now();
+    return duration_cast<nanoseconds>(end - start).count()
+           / static_cast<f64>(rounds);
+}
+
+void print_row(const string& kernel, const string& impl, f64 ns, f64 base) {
+    cout << std::left << std::setw(16) << kernel << std::setw(10) << impl
+         << std::right << std::setw(10) << std::fixed << std::setprecision(2)
+         << ns << " ns" << std::setw(9) << base / ns << "x" << endl;
+}
+
+/// @brief Compare a sorted f64 or u32 union against std::set_union.
+template <typename T, typename Union>
+bool union_matches(Union fn, const vector<T>& a, const vector<T>& b) {
+    vector<T> ref, out(a.size() + b.size());
+    std::set_union(a.begin(), a.end(), b.begin(), b.end(),
+                   std::back_inserter(ref));
+    u32 n = fn(a.data(), a.size(), b.data(), b.size(), out.data());
+    return n == ref.size() && std::equal(ref.begin(), ref.end(), out.begin());
+}
+
+/// @brief Check every kernel of a table against the scalar code it
+///        replaces on all inputs of a pool.
+/// @return Number of kernels giving a wrong result, each reported.
+u32 check_kernels(const simd::KernelTable& k, const vector<bench_input>& pool,
+                  u32 size) {
+    bool ok[7] = {true, true, true, true, true, true, true};
+    for (const auto& in : pool) {
+        ok[0] &= union_matches(k.union_f64, in.f1, in.f2);
+        ok[1] &= union_matches(k.union_f64, in.f1, in.f1);
+        ok[2] &= union_matches(k.union_u32, in.u1, in.u2);
+        for (u32 key : in.keys) {
+            ok[3] &= k.lower_bound_f64(in.f1.data(), size, key)
+                     == static_cast<u32>(std::lower_bound(in.f1.begin(),
+                            in.f1.end(), static_cast<f64>(key))
+                        - in.f1.begin());
+            ok[4] &= k.lower_bound_u32(in.u1.data(), size, key)
+                     == static_cast<u32>(std::lower_bound(in.u1.begin(),
+                            in.u1.end(), key) - in.u1.begin());
+        }
+        vec_u32 ref_min(in.u2), res_min(in.u2);
+        vec_u32 ref_add(in.u2), res_add(in.u2);
+        for (u32 j = 0; j < size; ++j) {
+            ref_min[j] = std::min(ref_min[j], in.u1[j]);
+            ref_add[j] += in.u1[j];
+        }
+        k.min_u32(res_min.data(), in.u1.data(), size);
+        k.add_u32(res_add.data(), in.u1.data(), size);
+        ok[5] &= res_min == ref_min;
+        ok[6] &= res_add == ref_add;
+    }
+
+    const char* kernels[7] = {"union_f64", "union_same", "union_u32",
+                              "lower_bound_f64", "lower_bound_u32",
+                              "min_u32", "add_u32"};
+    u32 wrong = 0;
+    for (u32 i = 0; i < 7; ++i) {
+        if (!ok[i]) {
+            cerr << simd::levelName(k.level) << " " << kernels[i]
+                 << " mismatch" << endl;
+            ++wrong;
+        }
+    }
+    return wrong;
+}
+
+/// Number of kernels found wrong, over all sizes and levels.
+u32 mismatches = 0;
+
+void run_size(u32 size, u32 rounds) {
+    vector<bench_input> pool;
+    for (u32 i = 0; i < POOL; ++i) {
+        pool.push_back(make_input(size, i));
+    }
+    volatile u32 sink = 0;   // just for avoiding optimization
+    vec_f64 out_f(2 * size);
+    vec_u32 out_u(2 * size);
+    vec_u32 dst(size);
+
+    cout << "size: " << size << endl;
+
+    // current scalar code
+    f64 base_union_f64 = time_ns(rounds, [&](u32 i) {
+        const auto& in = pool[i % POOL];
+        vec_f64 res;
+        res.reserve(in.f1.size() + in.f2.size());
+        std::set_union(in.f1.begin(), in.f1.end(), in.f2.begin(),
+                       in.f2.end(), std::back_inserter(res));
+        sink = res.size();
+    });
+    f64 base_union_same = time_ns(rounds, [&](u32 i) {
+        const auto& in = pool[i % POOL];
+        vec_f64 res;
+        res.reserve(2 * in.f1.size());
+        std::set_union(in.f1.begin(), in.f1.end(), in.f1.begin(),
+                       in.f1.end(), std::back_inserter(res));
+        sink = res.size();
+    });
+    f64 base_union_u32 = time_ns(rounds, [&](u32 i) {
+        const auto& in = pool[i % POOL];
+        vec_u32 res;
+        res.reserve(in.u1.size() + in.u2.size());
+        std::set_union(in.u1.begin(), in.u1.end(), in.u2.begin(),
+                       in.u2.end(), std::back_inserter(res));
+        sink = res.size();
+    });
+    f64 base_lb_f64 = time_ns(rounds, [&](u32 i) {
+        const auto& in = pool[i % POOL];
+        f64 key = in.keys[i & 255];
+        u32 pos = 0;
+        for (; pos < in.f1.size() && in.f1[pos] < key; ++pos);
+        sink = pos;
+    });
+    f64 base_lb_u32 = time_ns(rounds, [&](u32 i) {
+        const auto& in = pool[i % POOL];
+        u32 key = in.keys[i & 255];
+        u32 pos = 0;
+        for (; pos < in.u1.size() && in.u1[pos] < key; ++pos);
+        sink = pos;
+    });
+    f64 base_min = time_ns(rounds, [&](u32 i) {
+        const auto& in = pool[i % POOL];
+        for (u32 j = 0; j < size; ++j) {
+            dst[j] = std::min(dst[j], in.u1[j]);
+        }
+        sink = dst[0];
+    });
+    f64 base_add = time_ns(rounds, [&](u32 i) {
+        const auto& in = pool[i % POOL];
+        for (u32 j = 0; j < size; ++j) {
+            dst[j] += in.u1[j];
+        }
+        sink = dst[0];
+    });
+
+    print_row("union_f64", "baseline", base_union_f64, base_union_f64);
+    print_row("union_same", "baseline", base_union_same, base_union_same);
+    print_row("union_u32", "baseline", base_union_u32, base_union_u32);
+    print_row("lower_bound_f64", "baseline", base_lb_f64, base_lb_f64);
+    print_row("lower_bound_u32", "baseline", base_lb_u32, base_lb_u32);
+    print_row("min_u32", "baseline", base_min, base_min);
+    print_row("add_u32", "baseline", base_add, base_add);
+
+    for (u32 lv = 0; lv < simd::NUM_LEVELS; ++lv) {
+        auto level = static_cast<simd::SimdLevel>(lv);
+        if (!simd::supported(level)) {
+            continue;
+        }
+        const auto& k = simd::kernelsFor(level);
+        const string name = simd::levelName(level);
+
+        // check against the baseline before timing
+        mismatches += check_kernels(k, pool, size);
+
+        print_row("union_f64", name, time_ns(rounds, [&](u32 i) {
+            const auto& in = pool[i % POOL];
+            sink = k.union_f64(in.f1.data(), size, in.f2.data(), size,
+                               out_f.data());
+        }), base_union_f64);
+        print_row("union_same", name, time_ns(rounds, [&](u32 i) {
+            const auto& in = pool[i % POOL];
+            sink = k.union_f64(in.f1.data(), size, in.f1.data(), size,
+                               out_f.data());
+        }), base_union_same);
+        print_row("union_u32", name, time_ns(rounds, [&](u32 i) {
+            const auto& in = pool[i % POOL];
+            sink = k.union_u32(in.u1.data(), size, in.u2.data(), size,
+                               out_u.data());
+        }), base_union_u32);
+        print_row("lower_bound_f64", name, time_ns(rounds, [&](u32 i) {
+            const auto& in = pool[i % POOL];
+            sink = k.lower_bound_f64(in.f1.data(), size, in.keys[i & 255]);
+        }), base_lb_f64);
+        print_row("lower_bound_u32", name, time_ns(rounds, [&](u32 i) {
+            const auto& in = pool[i % POOL];
+            sink = k.lower_bound_u32(in.u1.data(), size, in.keys[i & 255]);
+        }), base_lb_u32);
+        print_row("min_u32", name, time_ns(rounds, [&](u32 i) {
+            k.min_u32(dst.data(), pool[i % POOL].u1.data(), size);
+            sink = dst[0];
+        }), base_min);
+        print_row("add_u32", name, time_ns(rounds, [&](u32 i) {
+            k.add_u32(dst.data(), pool[i % POOL].u1.data(), size);
+            sink = dst[0];
+        }), base_add);
+    }
+    (void) sink;
+    cout << endl;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 3) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    vec_u32 sizes = {8, 32, 128, 1024};
+    if (argc >= 2) {
+        sizes = {static_cast<u32>(std::stoul(argv[1]))};
+    }
+    u32 rounds = argc == 3 ? std::stoul(argv[2]) : 200000;
+
+    cout << "selected simd level: " << simd::levelName(simd::detect())
+         << endl << endl;
+    for (u32 size : sizes) {
+        run_size(size, rounds);
+    }
+    if (mismatches != 0) {
+        cerr << mismatches << " kernel results differ from the scalar code"
+             << endl;
+        return 1;
+    }
+}
@@ -0,0 +1,161 @@
+#pragma once
+#include "sketch_defs.hpp"
+#include "file_path.hpp"
+#include "flat_map.hpp"
+#include "pcap.hpp"
+#include "synth.hpp"
+#include <functional>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+namespace sketch {
+    /// @brief Record layout of a trace file.
+    enum TraceFormat {
+        CAIDA_TRACE,    ///< 21 B: u32 key, ..., f64 seconds at 13.
+        IMC_TRACE,      ///< 26 B: u32 key, ..., i64 time at 18.
+        MAWI_TRACE,     ///< 21 B: u32 key, ..., i64 time at 13.
+        NUM_TRACE_FORMATS,
+    };
+
+    /// @brief Per-flow inter-arrival conversion, whose state carries
+    ///        over calls, e.g. across chunks of a stream.
+    class InterArrival {
+    public:
+        /// @brief Constructor.
+        /// @param expected_flows Number of flows to make room for.
+        explicit InterArrival(u32 expected_flows = 0);
+
+        /// @brief Turn the timestamp of an item into the time since the
+        ///        last item of its flow, or keep it for a new flow.
+        inline void apply(FlowItem& item);
+
+        /// @brief Apply to items in [first, last) in order.
+        inline void apply(FlowItem* first, FlowItem* last);
+
+    private:
+        FlatMap lastSeen;   ///< Last timestamp of each flow.
+    };
+
+    /// @brief Source of flow items whose values are timestamps, which
+    ///        decodes up to a given number of items into a buffer and
+    ///        returns how many it decoded, 0 at the end.
+    using ItemSource = std::function<u64(FlowItem* out, u64 max)>;
+
+    /// @brief Return the number of bytes per record of a given format.
+    inline u32 record_size(TraceFormat format);
+
+    /// @brief Return if a dataset name is known.
+    /// @param dataset caida, imc, MAWI, pcap:<file> for flows by source
+    ///        IP, pcap5:<file> for flows by 5-tuple, or synth[:<spec>]
+    ///        for a synthetic trace as described by parse_synth.
+    inline bool valid_dataset(const string& dataset);
+
+    /// @brief Return a name of a dataset usable in file names.
+    inline string dataset_label(const string& dataset);
+
+    /// @brief Return the trace format of a given dataset name.
+    /// @param dataset caida, imc, or MAWI.
+    inline TraceFormat dataset_format(const string& dataset);
+
+    /// @brief Return the file path of a given dataset name.
+    /// @param dataset caida, imc, or MAWI.
+    inline const char* dataset_path(const string& dataset);
+
+    /// @brief Parse a trace file into flow items, whose values are
+    ///        timestamps in ticks since the first record, plus 1.
+    /// @details The file is memory-mapped and its fixed-stride records
+    ///          are decoded in parallel chunks straight into a vector
+    ///          sized from the file size. A trailing partial record is
+    ///          ignored.
+    /// @param filename Path of the trace file.
+    /// @param format Record layout of the file.
+    /// @param thread_num Number of decoding threads, 0 for all cores.
+    inline vector<FlowItem> parse_trace(const char* filename,
+                                        TraceFormat format,
+                                        u32 thread_num = 0);
+
+    /// @brief Turn timestamps into per-flow inter-arrival times in place.
+    /// @details The first item of each flow keeps its timestamp. Items
+    ///          are partitioned by a hash of their flow ID, and each
+    ///          partition is walked in trace order by its own thread
+    ///          with its own flat hash map.
+    /// @param items Items to be converted.
+    /// @param thread_num Number of threads, 0 for all cores.
+    inline void to_inter_arrival(vector<FlowItem>& items,
+                                 u32 thread_num = 0);
+
+    /// @brief Stream of per-flow inter-arrival times read from a trace
+    ///        chunk by chunk, without holding the whole trace.
+    /// @details A reader thread pulls fixed-size chunks of items from a
+    ///          source and converts them with one InterArrival, so the
+    ///          flow state carries across chunks. Decoded chunks go into
+    ///          a ring of reusable buffers, and the reader waits while
+    ///          all of them are in use. Memory is bounded by the chunk
+    ///          size times the ring size, plus the flow state.
+    class TraceStream {
+    public:
+        /// @brief Constructor, which starts the reader thread.
+        /// @param source Source of timestamped items, called from the
+        ///        reader thread only.
+        /// @param convert If the items are timestamps to be turned into
+        ///        inter-arrival times, or already are such times.
+        /// @param chunk_records Number of items per chunk.
+        /// @param ring_size Number of chunk buffers.
+        explicit TraceStream(ItemSource source, bool convert = true,
+                             u32 chunk_records = 1 << 16, u32 ring_size = 4);
+
+        /// @brief Constructor reading a trace file of a given format
+        ///        through read(), one chunk of records at a time.
+        TraceStream(const char* filename, TraceFormat format,
+                    u32 chunk_records = 1 << 16, u32 ring_size = 4);
+
+        /// @brief Destructor, which stops the reader thread.
+        ~TraceStream();
+
+        TraceStream(const TraceStream&) = delete;
+        TraceStream& operator=(const TraceStream&) = delete;
+
+        /// @brief Return the next chunk, or @c nullptr at the end.
+        /// @details The chunk stays valid until the next call, which
+        ///          hands its buffer back to the reader. Errors of the
+        ///          reader are rethrown here.
+        inline const vector<FlowItem>* next();
+
+    private:
+        ItemSource source;              ///< Source of the items.
+        bool convert;                   ///< If values are timestamps.
+        u32 chunkRecords;               ///< Items per chunk.
+        vector<vector<FlowItem>> ring;  ///< Chunk buffers.
+
+        std::mutex mtx;
+        std::condition_variable cv;
+        u64 produced = 0;       ///< Number of chunks filled.
+        u64 consumed = 0;       ///< Number of chunks handed back.
+        bool holding = false;   ///< If the consumer holds a chunk.
+        bool done = false;      ///< If the reader finished.
+        bool stop = false;      ///< If the reader should stop.
+        std::exception_ptr error;   ///< Error of the reader.
+        std::thread reader;
+
+        /// @brief Body of the reader thread.
+        inline void readAll();
+    };
+
+    /// @brief Load a dataset as per-flow inter-arrival times.
+    /// @details The result of a trace or capture is cached next to the
+    ///          source file, in <source>.m4c (<source>.5tuple.m4c for
+    ///          pcap5), and read from there while the cache is no older
+    ///          than the source. Synthetic traces are generated in
+    ///          parallel instead.
+    /// @param dataset A name accepted by valid_dataset.
+    inline vector<FlowItem> load_dataset(const string& dataset);
+
+    /// @brief Open a dataset as a stream of per-flow inter-arrival times.
+    /// @param dataset A name accepted by valid_dataset.
+    inline std::unique_ptr<TraceStream> stream_dataset(const string& dataset);
+}   // namespace sketch
+
+#include "dataset_impl.hpp"
@@ -0,0 +1,497 @@
+#pragma once
+#include "dataset.hpp"
+#include "flat_map.hpp"
+#include "mapped_file.hpp"
+#include "parallel.hpp"
+#include "trace_cache.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace sketch {
+namespace detail {
+    /// @brief Partition of a flow ID, with bits independent of those
+    ///        the FlatMap uses.
+    inline u32 flow_partition(u32 id, u32 partition_num) {
+        u64 h = static_cast<u64>(id) * 0x9e3779b97f4a7c15ULL;
+        return static_cast<u32>((h >> 32) * partition_num >> 32);
+    }
+
+    /// @brief Turn timestamps of items at given indices, in increasing
+    ///        order, into per-flow inter-arrival times.
+    template <typename Iter>
+    void inter_arrival_of(FlowItem* items, Iter first, Iter last,
+                          u32 expected_flows) {
+        InterArrival conv(expected_flows);
+        for (; first != last; ++first) {
+            conv.apply(items[*first]);
+        }
+    }
+
+    /// @brief Counting iterator over [0, n).
+    struct IndexIter {
+        u64 i;
+        u64 operator*() const { return i; }
+        IndexIter& operator++() { ++i; return *this; }
+        bool operator!=(const IndexIter& other) const {
+            return i != other.i;
+        }
+    };
+
+    /// @brief Load an unaligned value from a record.
+    template <typename T>
+    inline T load(const char* p) {
+        T v;
+        std::memcpy(&v, p, sizeof(T));
+        return v;
+    }
+
+    /// @brief Decode @c n records of a given format starting at @c rec.
+    /// @param origin First record of the trace, whose timestamp is 0.
+    template <TraceFormat FORMAT>
+    void decode_records(const char* origin, const char* rec, u64 n,
+                        FlowItem* out) {
+        const u32 stride = record_size(FORMAT);
+        if constexpr (FORMAT == CAIDA_TRACE) {
+            const f64 t0 = load<f64>(origin + 13);
+            for (u64 i = 0; i < n; ++i, rec += stride) {
+                f64 t = load<f64>(rec + 13);
+                out[i] = {load<u32>(rec), u32((t - t0) * 10000000) + 1};
+            }
+        } else if constexpr (FORMAT == IMC_TRACE) {
+            const long long t0 = load<long long>(origin + 18);
+            for (u64 i = 0; i < n; ++i, rec += stride) {
+                long long t = load<long long>(rec + 18);
+                out[i] = {load<u32>(rec), u32((t - t0) / 100) + 1};
+            }
+        } else {
+            const long long t0 = load<long long>(origin + 13);
+            for (u64 i = 0; i < n; ++i, rec += stride) {
+                long long t = load<long long>(rec + 13);
+                out[i] = {load<u32>(rec), u32((t - t0) * 100000) + 1};
+            }
+        }
+    }
+
+    /// @brief Decode @c n records of a given format starting at @c rec.
+    inline void decode_records(TraceFormat format, const char* origin,
+                               const char* rec, u64 n, FlowItem* out) {
+        switch (format) {
+        case CAIDA_TRACE:
+            decode_records<CAIDA_TRACE>(origin, rec, n, out);
+            break;
+        case IMC_TRACE:
+            decode_records<IMC_TRACE>(origin, rec, n, out);
+            break;
+        case MAWI_TRACE:
+            decode_records<MAWI_TRACE>(origin, rec, n, out);
+            break;
+        default:
+            throw std::invalid_argument("unknown trace format");
+        }
+    }
+
+    /// @brief Sequential reader of a trace file through read(), which
+    ///        keeps a partial record for the next call.
+    class RecordReader {
+    public:
+        RecordReader(const char* filename, TraceFormat format_)
+            : format(format_), stride(record_size(format_)) {
+            fd = open(filename, O_RDONLY);
+            if (fd < 0) {
+                throw std::runtime_error("cannot open file");
+            }
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+
+        ~RecordReader() {
+            close(fd);
+        }
+
+        RecordReader(const RecordReader&) = delete;
+        RecordReader& operator=(const RecordReader&) = delete;
+
+        /// @brief Decode up to @c max records, 0 at the end.
+        u64 read(FlowItem* out, u64 max) {
+            if (raw.size() < max * stride) {
+                raw.resize(max * stride);
+            }
+            // fill raw as far as needed, keeping any partial record
+            while (!eof && filled < max * stride) {
+                ssize_t got = ::read(fd, raw.data() + filled,
+                                     max * stride - filled);
+                if (got < 0) {
+                    throw std::runtime_error("cannot read file");
+                }
+                eof = got == 0;
+                filled += got;
+            }
+            const u64 n = std::min(max, filled / stride);
+            if (n == 0) {
+                return 0;
+            }
+            if (!hasOrigin) {
+                std::memcpy(origin, raw.data(), stride);
+                hasOrigin = true;
+            }
+            decode_records(format, origin, raw.data(), n, out);
+            filled -= n * stride;
+            std::memmove(raw.data(), raw.data() + n * stride, filled);
+            return n;
+        }
+
+    private:
+        int fd;
+        TraceFormat format;
+        u32 stride;             ///< Bytes per record.
+        vector<char> raw;       ///< Bytes read but not decoded.
+        u64 filled = 0;         ///< Number of bytes in raw.
+        bool eof = false;
+        char origin[32];        ///< First record of the trace.
+        bool hasOrigin = false;
+    };
+
+    /// @brief Split a pcap dataset name into its file and flow key.
+    /// @return If the name is pcap:<file> or pcap5:<file>.
+    inline bool pcap_dataset(const string& dataset, string& path,
+                             FlowKey& key) {
+        if (dataset.size() > 5 && dataset.compare(0, 5, "pcap:") == 0) {
+            path = dataset.substr(5);
+            key = SRC_IP_KEY;
+            return true;
+        }
+        if (dataset.size() > 6 && dataset.compare(0, 6, "pcap5:") == 0) {
+            path = dataset.substr(6);
+            key = FIVE_TUPLE_KEY;
+            return true;
+        }
+        return false;
+    }
+
+    /// @brief Split a synthetic dataset name into its parameters.
+    /// @return If the name is synth or synth:<spec>.
+    inline bool synth_dataset(const string& dataset, SynthConfig& config) {
+        if (dataset == "synth") {
+            config = SynthConfig();
+            return true;
+        }
+        if (dataset.size() > 6 && dataset.compare(0, 6, "synth:") == 0) {
+            config = parse_synth(dataset.substr(6));
+            return true;
+        }
+        return false;
+    }
+}   // namespace detail
+
+    InterArrival::InterArrival(u32 expected_flows)
+        : lastSeen(expected_flows) {}
+
+    void InterArrival::apply(FlowItem& item) {
+        u32& seen = lastSeen[item.id];
+        u32 temp = item.value;
+        item.value = std::max(1u, item.value - seen);
+        seen = temp;
+    }
+
+    void InterArrival::apply(FlowItem* first, FlowItem* last) {
+        for (; first != last; ++first) {
+            apply(*first);
+        }
+    }
+
+    u32 record_size(TraceFormat format) {
+        switch (format) {
+        case CAIDA_TRACE:
+            return 21;
+        case IMC_TRACE:
+            return 26;
+        case MAWI_TRACE:
+            return 21;
+        default:
+            throw std::invalid_argument("unknown trace format");
+        }
+    }
+
+    bool valid_dataset(const string& dataset) {
+        string path;
+        FlowKey key;
+        SynthConfig config;
+        try {
+            return dataset == "caida" || dataset == "imc"
+                || dataset == "MAWI"
+                || detail::pcap_dataset(dataset, path, key)
+                || detail::synth_dataset(dataset, config);
+        } catch (const std::exception& e) {
+            cerr << dataset << ": " << e.what() << endl;
+            return false;
+        }
+    }
+
+    string dataset_label(const string& dataset) {
+        string path;
+        FlowKey key;
+        if (dataset.compare(0, 6, "synth:") == 0) {
+            return "synth_" + dataset.substr(6);
+        }
+        if (!detail::pcap_dataset(dataset, path, key)) {
+            return dataset;
+        }
+        const u64 slash = path.find_last_of('/');
+        return (key == SRC_IP_KEY ? "pcap_" : "pcap5_")
+             + (slash == string::npos ? path : path.substr(slash + 1));
+    }
+
+    TraceFormat dataset_format(const string& dataset) {
+        if (dataset == "caida") {
+            return CAIDA_TRACE;
+        } else if (dataset == "imc") {
+            return IMC_TRACE;
+        } else if (dataset == "MAWI") {
+            return MAWI_TRACE;
+        }
+        throw std::invalid_argument("unknown dataset");
+    }
+
+    const char* dataset_path(const string& dataset) {
+        switch (dataset_format(dataset)) {
+        case CAIDA_TRACE:
+            return caida_path;
+        case IMC_TRACE:
+            return imc_path;
+        default:
+            return mawi_path;
+        }
+    }
+
+    vector<FlowItem> parse_trace(const char* filename, TraceFormat format,
+                                 u32 thread_num) {
+        detail::MappedFile file(filename);
+        const u64 n = file.size() / record_size(format);
+        vector<FlowItem> vec(n);
+        if (n == 0) {
+            return vec;
+        }
+
+        // Chunks are contiguous record ranges, each decoded into its own
+        // slice of the output, so no synchronisation is needed.
+        thread_num = detail::thread_count(n, thread_num);
+        const u64 chunk = (n + thread_num - 1) / thread_num;
+        detail::run_threads(thread_num, [&](u32 t) {
+            u64 first = std::min(n, t * chunk);
+            u64 last = std::min(n, first + chunk);
+            detail::decode_records(format, file.data(),
+                                   file.data() + first * record_size(format),
+                                   last - first, vec.data() + first);
+        });
+
+        return vec;
+    }
+
+    void to_inter_arrival(vector<FlowItem>& items, u32 thread_num) {
+        const u64 n = items.size();
+        if (n > UINT32_MAX) {
+            throw std::length_error("too many items");
+        }
+        // partitions are tagged with a u8 per item
+        thread_num = std::min(detail::thread_count(n, thread_num), 256u);
+        // Most traces hold far fewer flows than packets, and an oversized
+        // table costs cache misses, so start small and grow.
+        const u32 expected_flows = std::min<u64>(n / thread_num, 1 << 16);
+        if (thread_num == 1) {
+            detail::inter_arrival_of(items.data(), detail::IndexIter{0},
+                                     detail::IndexIter{n}, expected_flows);
+            return;
+        }
+
+        // Partition items by flow ID, so each flow belongs to exactly one
+        // thread. Indices are grouped by partition, then by chunk, so
+        // each partition sees its items in trace order.
+        const u32 parts = thread_num;
+        const u64 chunk = (n + parts - 1) / parts;
+        vector<u8> part_of(n);
+        vector<u64> offset(parts * parts + 1, 0);   // [part][chunk]
+        detail::run_threads(parts, [&](u32 c) {
+            u64 first = std::min(n, c * chunk);
+            u64 last = std::min(n, first + chunk);
+            vector<u64> cnt(parts, 0);
+            for (u64 i = first; i < last; ++i) {
+                part_of[i] = detail::flow_partition(items[i].id, parts);
+                ++cnt[part_of[i]];
+            }
+            for (u32 p = 0; p < parts; ++p) {
+                offset[p * parts + c + 1] = cnt[p];
+            }
+        });
+        for (u64 k = 1; k < offset.size(); ++k) {
+            offset[k] += offset[k - 1];
+        }
+
+        vector<u32> index(n);
+        detail::run_threads(parts, [&](u32 c) {
+            u64 first = std::min(n, c * chunk);
+            u64 last = std::min(n, first + chunk);
+            vector<u64> pos(parts);
+            for (u32 p = 0; p < parts; ++p) {
+                pos[p] = offset[p * parts + c];
+            }
+            for (u64 i = first; i < last; ++i) {
+                index[pos[part_of[i]]++] = i;
+            }
+        });
+
+        detail::run_threads(parts, [&](u32 p) {
+            detail::inter_arrival_of(items.data(),
+                                     index.begin() + offset[p * parts],
+                                     index.begin() + offset[(p + 1) * parts],
+                                     expected_flows);
+        });
+    }
+
+    TraceStream::TraceStream(ItemSource source_, bool convert_,
+                             u32 chunk_records, u32 ring_size)
+        : source(std::move(source_)), convert(convert_),
+          chunkRecords(chunk_records), ring(ring_size) {
+        if (chunk_records == 0 || ring_size == 0) {
+            throw std::invalid_argument("empty trace stream buffers");
+        }
+        for (auto& buf : ring) {
+            buf.reserve(chunk_records);
+        }
+        reader = std::thread(&TraceStream::readAll, this);
+    }
+
+    TraceStream::TraceStream(const char* filename, TraceFormat format,
+                             u32 chunk_records, u32 ring_size)
+        : TraceStream(
+              [file = std::make_shared<detail::RecordReader>(filename, format)]
+              (FlowItem* out, u64 max) { return file->read(out, max); },
+              true, chunk_records, ring_size) {}
+
+    TraceStream::~TraceStream() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stop = true;
+        }
+        cv.notify_all();
+        reader.join();
+    }
+
+    const vector<FlowItem>* TraceStream::next() {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (holding) {
+            holding = false;
+            ++consumed;
+            cv.notify_all();
+        }
+        cv.wait(lock, [this] { return produced > consumed || done; });
+        if (produced > consumed) {
+            holding = true;
+            return &ring[consumed % ring.size()];
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return nullptr;
+    }
+
+    void TraceStream::readAll() {
+        try {
+            InterArrival conv(1 << 16);
+            while (true) {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [this] {
+                    return produced - consumed < ring.size() || stop;
+                });
+                if (stop) {
+                    break;
+                }
+                auto& buf = ring[produced % ring.size()];
+                lock.unlock();
+
+                // the consumer does not touch this buffer until produced
+                // moves past it
+                buf.resize(chunkRecords);
+                const u64 n = source(buf.data(), chunkRecords);
+                if (n == 0) {
+                    break;
+                }
+                buf.resize(n);
+                if (convert) {
+                    conv.apply(buf.data(), buf.data() + n);
+                }
+
+                lock.lock();
+                ++produced;
+                lock.unlock();
+                cv.notify_all();
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mtx);
+            error = std::current_exception();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            done = true;
+        }
+        cv.notify_all();
+    }
+
+    vector<FlowItem> load_dataset(const string& dataset) {
+        SynthConfig config;
+        if (detail::synth_dataset(dataset, config)) {
+            return generate_trace(config);
+        }
+
+        string path;
+        FlowKey key;
+        const bool pcap = detail::pcap_dataset(dataset, path, key);
+        if (!pcap) {
+            path = dataset_path(dataset);
+        }
+        const string cache = path + (pcap && key == FIVE_TUPLE_KEY
+                                     ? ".5tuple.m4c" : ".m4c");
+        if (cache_fresh(cache.c_str(), path.c_str())) {
+            try {
+                return read_cache(cache.c_str());
+            } catch (const std::exception& e) {
+                cerr << cache << ": " << e.what() << ", rebuilding" << endl;
+            }
+        }
+
+        auto vec = pcap ? parse_pcap(path.c_str(), key)
+                        : parse_trace(path.c_str(), dataset_format(dataset));
+        to_inter_arrival(vec);
+        try {
+            write_cache(cache.c_str(), vec);
+        } catch (const std::exception& e) {
+            // e.g. a read-only dataset directory, only later runs suffer
+            cerr << cache << ": " << e.what() << endl;
+        }
+        return vec;
+    }
+
+    std::unique_ptr<TraceStream> stream_dataset(const string& dataset) {
+        SynthConfig config;
+        if (detail::synth_dataset(dataset, config)) {
+            auto trace = std::make_shared<SynthTrace>(config);
+            return std::make_unique<TraceStream>(
+                [trace](FlowItem* out, u64 max) {
+                    return trace->read(out, max);
+                }, false);
+        }
+
+        string path;
+        FlowKey key;
+        if (detail::pcap_dataset(dataset, path, key)) {
+            auto file = std::make_shared<PcapReader>(path.c_str(), key);
+            return std::make_unique<TraceStream>(
+                [file](FlowItem* out, u64 max) {
+                    return file->read(out, max);
+                });
+        }
+        return std::make_unique<TraceStream>(dataset_path(dataset),
+                                             dataset_format(dataset));
+    }
+}   // namespace sketch
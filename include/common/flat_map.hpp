@@ -0,0 +1,49 @@
+#pragma once
+#include "sketch_defs.hpp"
+
+namespace sketch {
+    /// @brief Open-addressing hash map from u32 to u32.
+    /// @details Slots live in one flat array probed linearly, so a lookup
+    ///          is usually one cache miss and an insert allocates only
+    ///          when the table grows. Key 0 is kept aside, as it marks
+    ///          empty slots.
+    class FlatMap {
+    public:
+        /// @brief Constructor.
+        /// @param expected Number of keys to make room for up front.
+        explicit FlatMap(u32 expected = 0);
+
+        /// @brief Return the value of a given key, inserting 0 if absent.
+        inline u32& operator[](u32 key);
+
+        /// @brief Return a pointer to the value of a given key, or
+        ///        @c nullptr if absent.
+        inline const u32* find(u32 key) const;
+
+        /// @brief Return the number of keys.
+        inline u32 size() const;
+
+        /// @brief Make room for a given number of keys.
+        inline void reserve(u32 expected);
+
+    private:
+        struct Slot {
+            u32 key;
+            u32 value;
+        };
+
+        vector<Slot> slots;         ///< Slots, size is a power of 2.
+        u32 mask = 0;               ///< Number of slots minus 1.
+        u32 keyNum = 0;             ///< Number of keys besides key 0.
+        bool hasZero = false;       ///< If key 0 is present.
+        u32 zeroValue = 0;          ///< Value of key 0.
+
+        /// @brief Return the home slot of a given key.
+        inline u32 home(u32 key) const;
+
+        /// @brief Rehash all keys into a given number of slots.
+        inline void rehash(u32 slot_num);
+    };
+}   // namespace sketch
+
+#include "flat_map_impl.hpp"
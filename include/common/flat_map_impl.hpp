@@ -0,0 +1,90 @@
+#pragma once
+#include "flat_map.hpp"
+#include <stdexcept>
+
+namespace sketch {
+    FlatMap::FlatMap(u32 expected) {
+        reserve(expected);
+    }
+
+    u32 FlatMap::home(u32 key) const {
+        // murmur3 finalizer, keys are often IPs with poor low bits
+        key ^= key >> 16;
+        key *= 0x85ebca6bU;
+        key ^= key >> 13;
+        key *= 0xc2b2ae35U;
+        key ^= key >> 16;
+        return key & mask;
+    }
+
+    u32& FlatMap::operator[](u32 key) {
+        if (key == 0) {
+            hasZero = true;
+            return zeroValue;
+        }
+        // keep the load factor no more than 1/2
+        if (2 * (keyNum + 1) > slots.size()) {
+            rehash(slots.empty() ? 16 : 2 * slots.size());
+        }
+        u32 pos = home(key);
+        while (slots[pos].key != 0) {
+            if (slots[pos].key == key) {
+                return slots[pos].value;
+            }
+            pos = (pos + 1) & mask;
+        }
+        ++keyNum;
+        slots[pos] = {key, 0};
+        return slots[pos].value;
+    }
+
+    const u32* FlatMap::find(u32 key) const {
+        if (key == 0) {
+            return hasZero ? &zeroValue : nullptr;
+        }
+        if (slots.empty()) {
+            return nullptr;
+        }
+        u32 pos = home(key);
+        while (slots[pos].key != 0) {
+            if (slots[pos].key == key) {
+                return &slots[pos].value;
+            }
+            pos = (pos + 1) & mask;
+        }
+        return nullptr;
+    }
+
+    u32 FlatMap::size() const {
+        return keyNum + hasZero;
+    }
+
+    void FlatMap::reserve(u32 expected) {
+        u64 slot_num = 16;
+        while (slot_num < 2 * static_cast<u64>(expected)) {
+            slot_num *= 2;
+        }
+        if (slot_num > UINT32_MAX) {
+            throw std::length_error("flat map too large");
+        }
+        if (slot_num > slots.size()) {
+            rehash(slot_num);
+        }
+    }
+
+    void FlatMap::rehash(u32 slot_num) {
+        vector<Slot> old(slot_num, Slot{0, 0});
+        old.swap(slots);
+        mask = slot_num - 1;
+        for (const auto& slot : old) {
+            if (slot.key == 0) {
+                continue;
+            }
+            u32 pos = home(slot.key);
+            while (slots[pos].key != 0) {
+                pos = (pos + 1) & mask;
+            }
+            slots[pos] = slot;
+        }
+    }
+}   // namespace sketch
@@ -48,17 +48,15 @@ namespace sketch {
 
     Histogram Histogram::minAligned(const Histogram& h1, const Histogram& h2) {
         Histogram res = h1;
-        for (u32 i = 0; i < res.m_heights.size(); ++i) {
-            res.m_heights[i] = std::min(res.m_heights[i], h2.m_heights[i]);
-        }
+        simd::kernels().min_u32(res.m_heights.data(), h2.m_heights.data(),
+                                res.m_heights.size());
         return res;
     }
 
     Histogram Histogram::sumAligned(const Histogram& h1, const Histogram& h2) {
         Histogram res = h1;
-        for (u32 i = 0; i < res.m_heights.size(); ++i) {
-            res.m_heights[i] += h2.m_heights[i];
-        }
+        simd::kernels().add_u32(res.m_heights.data(), h2.m_heights.data(),
+                                res.m_heights.size());
         return res;
     }
 
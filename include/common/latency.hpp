@@ -0,0 +1,81 @@
+#pragma once
+#include "sketch_defs.hpp"
+
+namespace sketch {
+    /// @brief Histogram of latencies in nanoseconds, in the layout of
+    ///        HdrHistogram.
+    /// @details Values below 2^SUB_BITS have a bucket each. Above, each
+    ///          power of 2 is split into 2^(SUB_BITS - 1) buckets, so a
+    ///          value is known within 1/128 of itself, and any u64 fits
+    ///          in a fixed number of buckets.
+    class LatencyHistogram {
+    public:
+        LatencyHistogram();
+
+        /// @brief Record a latency.
+        inline void record(u64 ns);
+
+        /// @brief Add the latencies of another histogram.
+        inline void merge(const LatencyHistogram& other);
+
+        /// @brief Return the number of recorded latencies.
+        inline u64 count() const;
+
+        /// @brief Return the largest recorded latency, 0 if none.
+        inline u64 max() const;
+
+        /// @brief Return the mean recorded latency, 0 if none.
+        inline f64 mean() const;
+
+        /// @brief Return the latency at a given percentile, i.e. the
+        ///        highest value of the bucket it falls into, 0 if none.
+        /// @param p Percentile in [0, 100].
+        inline u64 percentile(f64 p) const;
+
+    private:
+        static constexpr u32 SUB_BITS = 8;
+        static constexpr u64 HALF = 1 << (SUB_BITS - 1);
+
+        vector<u64> counts;     ///< Number of latencies per bucket.
+        u64 total = 0;          ///< Number of recorded latencies.
+        u64 sum = 0;            ///< Sum of recorded latencies.
+        u64 maxValue = 0;       ///< Largest recorded latency.
+
+        /// @brief Return the bucket of a given value.
+        static inline u32 bucket(u64 v);
+
+        /// @brief Return the highest value of a given bucket.
+        static inline u64 highest(u32 idx);
+    };
+
+    /// @brief Picker of operations to time, one in @c every on average.
+    /// @details Gaps between picks are drawn uniformly from
+    ///          [1, 2 * every - 1], so that sampling does not lock onto
+    ///          periodic work such as compactions every few appends.
+    class LatencySampler {
+    public:
+        /// @brief Constructor.
+        /// @param every_ Mean gap between picks, 0 to pick nothing.
+        /// @param seed Seed of the gaps.
+        explicit LatencySampler(u32 every_ = 0, u64 seed = 0);
+
+        /// @brief Return if the next operation is to be timed.
+        inline bool due();
+
+    private:
+        u64 state;      ///< Generator state of the gaps.
+        u32 every;      ///< Mean gap between picks.
+        u32 countdown;  ///< Operations until the next pick.
+
+        inline u32 gap();
+    };
+
+    /// @brief Run op(i) for i in [0, n), timing the calls picked by a
+    ///        sampler into a histogram. A timed call also pays for two
+    ///        clock reads, some 20 ns.
+    template <typename F>
+    inline void run_sampled(u64 n, F op, LatencySampler& sampler,
+                            LatencyHistogram& latency);
+}   // namespace sketch
+
+#include "latency_impl.hpp"
@@ -0,0 +1,104 @@
+#pragma once
+#include "latency.hpp"
+#include "sketch_utils.hpp"
+#include <algorithm>
+
+namespace sketch {
+    LatencyHistogram::LatencyHistogram()
+        : counts(bucket(UINT64_MAX) + 1, 0) { }
+
+    u32 LatencyHistogram::bucket(u64 v) {
+        if (v < 2 * HALF) {
+            return v;
+        }
+        // v >> shift lies in [HALF, 2 * HALF)
+        const u32 shift = 64 - __builtin_clzll(v) - SUB_BITS;
+        return shift * HALF + (v >> shift);
+    }
+
+    u64 LatencyHistogram::highest(u32 idx) {
+        if (idx < 2 * HALF) {
+            return idx;
+        }
+        const u32 shift = idx / HALF - 1;
+        const u64 sub = idx - shift * HALF;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    void LatencyHistogram::record(u64 ns) {
+        ++counts[bucket(ns)];
+        ++total;
+        sum += ns;
+        maxValue = std::max(maxValue, ns);
+    }
+
+    void LatencyHistogram::merge(const LatencyHistogram& other) {
+        for (u32 i = 0; i < counts.size(); ++i) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        sum += other.sum;
+        maxValue = std::max(maxValue, other.maxValue);
+    }
+
+    u64 LatencyHistogram::count() const {
+        return total;
+    }
+
+    u64 LatencyHistogram::max() const {
+        return maxValue;
+    }
+
+    f64 LatencyHistogram::mean() const {
+        return total == 0 ? 0 : static_cast<f64>(sum) / total;
+    }
+
+    u64 LatencyHistogram::percentile(f64 p) const {
+        if (total == 0) {
+            return 0;
+        }
+        // rank of the latency, counted from 1
+        const u64 rank = std::max<u64>(1, std::ceil(p / 100 * total));
+        u64 seen = 0;
+        for (u32 i = 0; i < counts.size(); ++i) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return std::min(highest(i), maxValue);
+            }
+        }
+        return maxValue;
+    }
+
+    LatencySampler::LatencySampler(u32 every_, u64 seed)
+        : state(seed), every(every_) {
+        countdown = every == 0 ? 0 : gap();
+    }
+
+    u32 LatencySampler::gap() {
+        return 1 + splitmix64(state) % (2 * static_cast<u64>(every) - 1);
+    }
+
+    bool LatencySampler::due() {
+        if (every == 0 || --countdown != 0) {
+            return false;
+        }
+        countdown = gap();
+        return true;
+    }
+
+    template <typename F>
+    void run_sampled(u64 n, F op, LatencySampler& sampler,
+                     LatencyHistogram& latency) {
+        for (u64 i = 0; i < n; ++i) {
+            if (sampler.due()) {
+                auto start = steady_clock::now();
+                op(i);
+                auto end = steady_clock::now();
+                latency.record(duration_cast<nanoseconds>(end - start)
+                               .count());
+            } else {
+                op(i);
+            }
+        }
+    }
+}   // namespace sketch
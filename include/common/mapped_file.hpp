@@ -0,0 +1,69 @@
+#pragma once
+#include "sketch_defs.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace sketch {
+namespace detail {
+    /// @brief Read-only memory mapping of a whole file.
+    class MappedFile {
+    public:
+        explicit MappedFile(const char* filename) {
+            int fd = open(filename, O_RDONLY);
+            if (fd < 0) {
+                throw std::runtime_error("cannot open file");
+            }
+            struct stat st;
+            if (fstat(fd, &st) != 0) {
+                close(fd);
+                throw std::runtime_error("cannot stat file");
+            }
+            len = st.st_size;
+            if (len > 0) {
+                void* p = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p == MAP_FAILED) {
+                    close(fd);
+                    throw std::runtime_error("cannot map file");
+                }
+                addr = static_cast<const char*>(p);
+                madvise(p, len, MADV_SEQUENTIAL);
+            }
+            close(fd);
+        }
+
+        ~MappedFile() {
+            if (addr != nullptr) {
+                munmap(const_cast<char*>(addr), len);
+            }
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        const char* data() const { return addr; }
+        u64 size() const { return len; }
+
+        /// @brief Unmap the resident pages of [0, offset), which a
+        ///        sequential reader is done with. They are faulted in
+        ///        again if touched.
+        void release(u64 offset) {
+            const u64 page = sysconf(_SC_PAGESIZE);
+            offset = std::min(offset, len) / page * page;
+            if (offset > released) {
+                madvise(const_cast<char*>(addr) + released,
+                        offset - released, MADV_DONTNEED);
+                released = offset;
+            }
+        }
+
+    private:
+        const char* addr = nullptr;
+        u64 len = 0;
+        u64 released = 0;   ///< Page-aligned end of released bytes.
+    };
+}   // namespace detail
+}   // namespace sketch
@@ -0,0 +1,176 @@
+#pragma once
+#include "sketch_defs.hpp"
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <pthread.h>
+#include <sched.h>
+
+namespace sketch {
+namespace detail {
+    /// Fewest records decoded by one thread, below which spawning more
+    /// threads costs more than it saves.
+    constexpr u64 MIN_CHUNK_RECORDS = 1 << 16;
+
+    /// @brief Return the number of threads to use for a given number of
+    ///        items, each thread taking at least MIN_CHUNK_RECORDS.
+    /// @param thread_num Requested number of threads, 0 for all cores.
+    inline u32 thread_count(u64 n, u32 thread_num) {
+        if (thread_num == 0) {
+            thread_num = std::max(1u, std::thread::hardware_concurrency());
+        }
+        u64 max_threads = (n + MIN_CHUNK_RECORDS - 1) / MIN_CHUNK_RECORDS;
+        return std::max<u64>(1, std::min<u64>(thread_num, max_threads));
+    }
+
+    /// @brief Run fn(t) for t in [0, thread_num), one thread each, with
+    ///        t = 0 on the calling thread.
+    template <typename F>
+    void run_threads(u32 thread_num, F fn) {
+        vector<std::thread> workers;
+        workers.reserve(thread_num - 1);
+        for (u32 t = 1; t < thread_num; ++t) {
+            workers.emplace_back(fn, t);
+        }
+        fn(0);
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    /// @brief Return the number of cores the calling thread may run on,
+    ///        which a pinned thread or a restricted process has fewer of.
+    inline u32 core_count() {
+        cpu_set_t set;
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            return std::max(1, CPU_COUNT(&set));
+        }
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    /// @brief Pin the calling thread to cores [first, first + count)
+    ///        of those it may run on, numbered from 0 as core_count()
+    ///        counts them, which threads it spawns later inherit.
+    /// @details Core IDs need not be 0, 1, ..., e.g. under a cpuset, so
+    ///          the cores are picked from the thread's allowed set.
+    /// @return If the thread is pinned. It is not if the allowed set
+    ///         cannot be read or set, or if none of the cores is in it.
+    inline bool pin_thread(u32 first, u32 count) {
+        cpu_set_t allowed, set;
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+            return false;
+        }
+        CPU_ZERO(&set);
+        u32 index = 0;
+        for (u32 c = 0; c < CPU_SETSIZE && index < first + count; ++c) {
+            if (!CPU_ISSET(c, &allowed)) {
+                continue;
+            }
+            if (index++ >= first) {
+                CPU_SET(c, &set);
+            }
+        }
+        return CPU_COUNT(&set) > 0
+            && pthread_setaffinity_np(pthread_self(), sizeof(set), &set)
+               == 0;
+    }
+
+    /// @brief Return the number of workers for a given number of tasks,
+    ///        no more than one per task.
+    /// @param thread_num Requested number of threads, 0 for all cores.
+    inline u32 worker_count(u64 task_num, u32 thread_num) {
+        if (thread_num == 0) {
+            thread_num = std::max(1u, std::thread::hardware_concurrency());
+        }
+        return std::max<u64>(1, std::min<u64>(thread_num, task_num));
+    }
+
+    /// @brief Run fn(t, first, last) over chunks [first, last) of [0, n)
+    ///        on thread_num threads, t being the running thread.
+    /// @details Each thread starts with an even share of the chunks and
+    ///          takes them from the front. A thread out of chunks steals
+    ///          from the back of the others' shares, so uneven chunks
+    ///          are balanced without a shared queue.
+    /// @param grain Number of items per chunk.
+    template <typename F>
+    void parallel_for(u64 n, u64 grain, u32 thread_num, F fn) {
+        const u64 chunk_num = (n + grain - 1) / grain;
+        if (chunk_num >= 1ull << 32) {
+            throw std::invalid_argument("too many chunks for parallel_for");
+        }
+        thread_num = worker_count(chunk_num, thread_num);
+
+        // share of each thread as front << 32 | back, in chunks
+        struct alignas(64) Share {
+            std::atomic<u64> range;
+        };
+        vector<Share> shares(thread_num);
+        for (u32 t = 0; t < thread_num; ++t) {
+            const u64 front = chunk_num * t / thread_num;
+            const u64 back = chunk_num * (t + 1) / thread_num;
+            shares[t].range.store(front << 32 | back,
+                                  std::memory_order_relaxed);
+        }
+
+        // take a chunk from the front of a share, or from its back
+        auto take = [&](u32 s, bool from_front, u64& chunk) {
+            auto& range = shares[s].range;
+            u64 cur = range.load(std::memory_order_relaxed);
+            while (true) {
+                const u64 front = cur >> 32, back = cur & UINT32_MAX;
+                if (front >= back) {
+                    return false;
+                }
+                const u64 next = from_front ? (front + 1) << 32 | back
+                                            : front << 32 | (back - 1);
+                if (range.compare_exchange_weak(cur, next,
+                                                std::memory_order_relaxed)) {
+                    chunk = from_front ? front : back - 1;
+                    return true;
+                }
+            }
+        };
+
+        run_threads(thread_num, [&](u32 t) {
+            u64 chunk;
+            auto run = [&] {
+                fn(t, chunk * grain, std::min(n, (chunk + 1) * grain));
+            };
+            while (take(t, true, chunk)) {
+                run();
+            }
+            for (u32 k = 1; k < thread_num; ++k) {
+                const u32 victim = (t + k) % thread_num;
+                while (take(victim, false, chunk)) {
+                    run();
+                }
+            }
+        });
+    }
+
+    /// @brief Spin lock guarding a lazily built cache, one byte large.
+    /// @details A copy starts unlocked, as it guards its own object.
+    class SpinLock {
+    public:
+        SpinLock() = default;
+        SpinLock(const SpinLock&) { }
+        SpinLock& operator=(const SpinLock&) { return *this; }
+
+        void lock() {
+            while (locked.exchange(true, std::memory_order_acquire)) {
+                while (locked.load(std::memory_order_relaxed)) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        void unlock() {
+            locked.store(false, std::memory_order_release);
+        }
+
+    private:
+        std::atomic<bool> locked{false};
+    };
+}   // namespace detail
+}   // namespace sketch
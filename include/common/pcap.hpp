@@ -0,0 +1,75 @@
+#pragma once
+#include "sketch_defs.hpp"
+#include "mapped_file.hpp"
+
+namespace sketch {
+    /// @brief What identifies the flow of a captured packet.
+    enum FlowKey {
+        SRC_IP_KEY,         ///< IPv4 source address, or a hash of IPv6.
+        FIVE_TUPLE_KEY,     ///< Hash of addresses, protocol and ports.
+    };
+
+    /// @brief Reader of pcap and pcapng captures, which turns IP packets
+    ///        into flow items straight from a memory mapping.
+    /// @details Both byte orders of both formats are accepted, and the
+    ///          link layer may be Ethernet (with VLAN tags), raw IP or
+    ///          Linux cooked capture. Packets which are not IPv4 or IPv6,
+    ///          or are truncated before the fields of the key, are
+    ///          skipped. Values are timestamps in 100 ns ticks since the
+    ///          first item, plus 1, as for the CAIDA trace. Pages already
+    ///          read are released as the reader moves on, so resident
+    ///          memory stays small on captures of any size.
+    class PcapReader {
+    public:
+        /// @brief Constructor, which maps the file and reads its header.
+        /// @param filename Path of the capture.
+        /// @param key What identifies a flow.
+        PcapReader(const char* filename, FlowKey key = SRC_IP_KEY);
+
+        /// @brief Decode the next items of the capture.
+        /// @param out Room for at least @c max items.
+        /// @return Number of items decoded, 0 at the end.
+        inline u64 read(FlowItem* out, u64 max);
+
+    private:
+        /// @brief Link layer and timestamp unit of an interface.
+        struct Interface {
+            u32 linkType;
+            u8 tsResol;     ///< pcapng if_tsresol: 10^-n, or 2^-n if MSB.
+        };
+
+        detail::MappedFile file;
+        FlowKey key;
+        u64 pos;                    ///< Offset of the next record.
+        bool ng;                    ///< If the file is pcapng.
+        bool swapped;               ///< If fields are byte-swapped.
+        vector<Interface> ifaces;   ///< Interfaces of the section.
+        bool hasOrigin = false;     ///< If t0 is set.
+        u64 t0 = 0;                 ///< Ticks of the first item.
+
+        /// @brief Load a field in the byte order of the file.
+        inline u32 load32(u64 offset) const;
+        inline u32 load16(u64 offset) const;
+
+        /// @brief Read the section header block at @c pos.
+        inline void readSection();
+
+        /// @brief Read the options of an interface description block.
+        inline void readInterface(u64 block, u64 block_len);
+
+        /// @brief Decode a packet into @c item, or return false if it
+        ///        is skipped.
+        inline bool decode(const u8* pkt, u32 cap_len, u32 link_type,
+                           u64 ticks, FlowItem& item);
+    };
+
+    /// @brief Parse a pcap or pcapng capture into flow items, whose
+    ///        values are timestamps in 100 ns ticks since the first
+    ///        item, plus 1.
+    /// @param filename Path of the capture.
+    /// @param key What identifies a flow.
+    inline vector<FlowItem> parse_pcap(const char* filename,
+                                       FlowKey key = SRC_IP_KEY);
+}   // namespace sketch
+
+#include "pcap_impl.hpp"
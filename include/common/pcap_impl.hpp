@@ -0,0 +1,371 @@
+#pragma once
+#include "pcap.hpp"
+#include <cstring>
+#include <stdexcept>
+
+namespace sketch {
+namespace detail {
+    constexpr u32 PCAP_MAGIC = 0xa1b2c3d4;          ///< Microseconds.
+    constexpr u32 PCAP_NSEC_MAGIC = 0xa1b23c4d;     ///< Nanoseconds.
+    constexpr u32 PCAPNG_SHB = 0x0a0d0d0a;          ///< Section header.
+    constexpr u32 PCAPNG_BYTE_ORDER = 0x1a2b3c4d;
+    constexpr u32 PCAPNG_IDB = 1;                   ///< Interface.
+    constexpr u32 PCAPNG_PB = 2;                    ///< Obsolete packet.
+    constexpr u32 PCAPNG_EPB = 6;                   ///< Enhanced packet.
+    constexpr u32 PCAPNG_IF_TSRESOL = 9;
+
+    constexpr u32 LINKTYPE_ETHERNET = 1;
+    constexpr u32 LINKTYPE_RAW = 101;
+    constexpr u32 LINKTYPE_LINUX_SLL = 113;
+    constexpr u32 LINKTYPE_IPV4 = 228;
+    constexpr u32 LINKTYPE_IPV6 = 229;
+    constexpr u32 LINKTYPE_LINUX_SLL2 = 276;
+
+    constexpr u32 ETHERTYPE_IPV4 = 0x0800;
+    constexpr u32 ETHERTYPE_IPV6 = 0x86dd;
+
+    /// @brief Load a big-endian (network order) u16.
+    inline u32 load_be16(const u8* p) {
+        return static_cast<u32>(p[0]) << 8 | p[1];
+    }
+
+    /// @brief Turn a timestamp in units of a pcapng if_tsresol into
+    ///        100 ns ticks.
+    inline u64 pcap_ticks(u64 ts, u8 resol) {
+        if (resol & 0x80) {
+            const unsigned __int128 scaled =
+                static_cast<unsigned __int128>(ts) * 10000000;
+            return static_cast<u64>(scaled >> (resol & 0x7f));
+        }
+        for (; resol > 7; --resol) {
+            ts /= 10;
+        }
+        for (; resol < 7; ++resol) {
+            ts *= 10;
+        }
+        return ts;
+    }
+
+    /// @brief Incremental hash of the fields of a flow key.
+    class KeyHash {
+    public:
+        void add(u64 word) {
+            h = (h ^ word) * 0x9fb21c651e98df25ULL;
+            h ^= h >> 29;
+        }
+
+        void add(const u8* p, u32 len) {
+            u64 word;
+            for (; len >= 8; p += 8, len -= 8) {
+                std::memcpy(&word, p, 8);
+                add(word);
+            }
+            if (len > 0) {
+                word = 0;
+                std::memcpy(&word, p, len);
+                add(word);
+            }
+        }
+
+        u32 value() const {
+            return static_cast<u32>(h ^ h >> 32);
+        }
+
+    private:
+        u64 h = 0x9e3779b97f4a7c15ULL;
+    };
+}   // namespace detail
+
+    PcapReader::PcapReader(const char* filename, FlowKey key_)
+        : file(filename), key(key_), pos(0) {
+        if (file.size() < 24) {
+            throw std::runtime_error("not a pcap file");
+        }
+        u32 magic;
+        std::memcpy(&magic, file.data(), 4);
+        if (magic == detail::PCAPNG_SHB) {
+            ng = true;
+            readSection();
+            return;
+        }
+
+        ng = false;
+        const u32 swapped_magic = __builtin_bswap32(magic);
+        swapped = swapped_magic == detail::PCAP_MAGIC
+               || swapped_magic == detail::PCAP_NSEC_MAGIC;
+        if (swapped) {
+            magic = swapped_magic;
+        }
+        if (magic != detail::PCAP_MAGIC && magic != detail::PCAP_NSEC_MAGIC) {
+            throw std::runtime_error("not a pcap file");
+        }
+        // the upper bits of the link type may carry FCS information
+        const u32 link_type = load32(20) & 0xffff;
+        if (link_type != detail::LINKTYPE_ETHERNET
+            && link_type != detail::LINKTYPE_RAW
+            && link_type != detail::LINKTYPE_LINUX_SLL
+            && link_type != detail::LINKTYPE_IPV4
+            && link_type != detail::LINKTYPE_IPV6
+            && link_type != detail::LINKTYPE_LINUX_SLL2) {
+            throw std::runtime_error("unsupported pcap link type");
+        }
+        ifaces.push_back(
+            {link_type, static_cast<u8>(magic == detail::PCAP_MAGIC ? 6 : 9)});
+        pos = 24;
+    }
+
+    u32 PcapReader::load32(u64 offset) const {
+        u32 v;
+        std::memcpy(&v, file.data() + offset, 4);
+        return swapped ? __builtin_bswap32(v) : v;
+    }
+
+    u32 PcapReader::load16(u64 offset) const {
+        uint16_t v;
+        std::memcpy(&v, file.data() + offset, 2);
+        return swapped ? __builtin_bswap16(v) : v;
+    }
+
+    void PcapReader::readSection() {
+        if (pos + 28 > file.size()) {
+            throw std::runtime_error("truncated pcapng section header");
+        }
+        u32 bom;
+        std::memcpy(&bom, file.data() + pos + 8, 4);
+        if (bom == detail::PCAPNG_BYTE_ORDER) {
+            swapped = false;
+        } else if (__builtin_bswap32(bom) == detail::PCAPNG_BYTE_ORDER) {
+            swapped = true;
+        } else {
+            throw std::runtime_error("not a pcapng file");
+        }
+        // interface IDs are local to a section
+        ifaces.clear();
+    }
+
+    void PcapReader::readInterface(u64 block, u64 block_len) {
+        Interface iface{load16(block + 8), 6};
+        for (u64 opt = block + 16; opt + 4 <= block + block_len - 4; ) {
+            const u32 code = load16(opt);
+            const u32 len = load16(opt + 2);
+            if (code == 0) {
+                break;
+            }
+            if (code == detail::PCAPNG_IF_TSRESOL && len >= 1) {
+                iface.tsResol = file.data()[opt + 4];
+            }
+            opt += 4 + (len + 3) / 4 * 4;
+        }
+        ifaces.push_back(iface);
+    }
+
+    u64 PcapReader::read(FlowItem* out, u64 max) {
+        const u64 size = file.size();
+        const u8* base = reinterpret_cast<const u8*>(file.data());
+        u64 n = 0;
+        while (n < max) {
+            const u8* pkt;
+            u32 cap_len;
+            u32 link_type;
+            u64 ticks;
+            if (ng) {
+                if (pos + 12 > size) {
+                    break;
+                }
+                u32 type;
+                std::memcpy(&type, file.data() + pos, 4);
+                if (type == detail::PCAPNG_SHB) {
+                    readSection();
+                }
+                type = load32(pos);
+                const u64 block = pos;
+                const u64 block_len = load32(pos + 4);
+                if (block_len < 12 || block_len % 4 != 0
+                    || block + block_len > size) {
+                    throw std::runtime_error("corrupt pcapng block");
+                }
+                pos += block_len;
+
+                if (type == detail::PCAPNG_IDB && block_len >= 20) {
+                    readInterface(block, block_len);
+                    continue;
+                }
+                if ((type != detail::PCAPNG_EPB && type != detail::PCAPNG_PB)
+                    || block_len < 32) {
+                    continue;
+                }
+                const u32 iface_id = type == detail::PCAPNG_EPB
+                                   ? load32(block + 8) : load16(block + 8);
+                cap_len = load32(block + 20);
+                if (iface_id >= ifaces.size() || 32 + static_cast<u64>(cap_len) > block_len) {
+                    continue;
+                }
+                link_type = ifaces[iface_id].linkType;
+                const u64 ts = static_cast<u64>(load32(block + 12)) << 32
+                             | load32(block + 16);
+                ticks = detail::pcap_ticks(ts, ifaces[iface_id].tsResol);
+                pkt = base + block + 28;
+            } else {
+                if (pos + 16 > size) {
+                    break;
+                }
+                cap_len = load32(pos + 8);
+                if (pos + 16 + cap_len > size) {
+                    break;      // truncated last record
+                }
+                const u8 resol = ifaces[0].tsResol;
+                const u64 frac = resol == 6 ? 1000000 : 1000000000;
+                ticks = detail::pcap_ticks(load32(pos) * frac
+                                           + load32(pos + 4), resol);
+                link_type = ifaces[0].linkType;
+                pkt = base + pos + 16;
+                pos += 16 + cap_len;
+            }
+            n += decode(pkt, cap_len, link_type, ticks, out[n]);
+        }
+        file.release(pos);
+        return n;
+    }
+
+    bool PcapReader::decode(const u8* pkt, u32 cap_len, u32 link_type,
+                            u64 ticks, FlowItem& item) {
+        // find the network layer
+        u32 off;
+        u32 proto;
+        switch (link_type) {
+        case detail::LINKTYPE_ETHERNET:
+            off = 14;
+            if (cap_len < off) {
+                return false;
+            }
+            proto = detail::load_be16(pkt + 12);
+            // 802.1Q, 802.1ad and QinQ tags
+            while (proto == 0x8100 || proto == 0x88a8 || proto == 0x9100) {
+                off += 4;
+                if (cap_len < off) {
+                    return false;
+                }
+                proto = detail::load_be16(pkt + off - 2);
+            }
+            break;
+        case detail::LINKTYPE_LINUX_SLL:
+            off = 16;
+            if (cap_len < off) {
+                return false;
+            }
+            proto = detail::load_be16(pkt + 14);
+            break;
+        case detail::LINKTYPE_LINUX_SLL2:
+            off = 20;
+            if (cap_len < off) {
+                return false;
+            }
+            proto = detail::load_be16(pkt);
+            break;
+        default:    // raw IP
+            off = 0;
+            if (cap_len < 1) {
+                return false;
+            }
+            proto = pkt[0] >> 4 == 4 ? detail::ETHERTYPE_IPV4
+                  : detail::ETHERTYPE_IPV6;
+            if (link_type == detail::LINKTYPE_IPV4) {
+                proto = detail::ETHERTYPE_IPV4;
+            } else if (link_type == detail::LINKTYPE_IPV6) {
+                proto = detail::ETHERTYPE_IPV6;
+            }
+            break;
+        }
+        const u8* ip = pkt + off;
+        const u32 len = cap_len - off;
+
+        // find the addresses and the transport layer
+        const u8* src;
+        u32 addr_len;
+        u32 l4;
+        u32 next;
+        bool first_fragment;
+        if (proto == detail::ETHERTYPE_IPV4) {
+            if (len < 20 || ip[0] >> 4 != 4) {
+                return false;
+            }
+            src = ip + 12;
+            addr_len = 4;
+            l4 = (ip[0] & 0xf) * 4;
+            if (l4 < 20) {
+                return false;
+            }
+            next = ip[9];
+            first_fragment = (detail::load_be16(ip + 6) & 0x1fff) == 0;
+        } else if (proto == detail::ETHERTYPE_IPV6) {
+            if (len < 40 || ip[0] >> 4 != 6) {
+                return false;
+            }
+            src = ip + 8;
+            addr_len = 16;
+            l4 = 40;
+            next = ip[6];
+            first_fragment = true;
+            // skip extension headers up to the transport layer
+            for (u32 k = 0; k < 8 && l4 + 8 <= len; ++k) {
+                if (next == 0 || next == 43 || next == 60) {
+                    next = ip[l4];
+                    l4 += (ip[l4 + 1] + 1) * 8;
+                } else if (next == 44) {
+                    first_fragment = (detail::load_be16(ip + l4 + 2)
+                                      & 0xfff8) == 0;
+                    next = ip[l4];
+                    l4 += 8;
+                } else if (next == 51) {
+                    next = ip[l4];
+                    l4 += (ip[l4 + 1] + 2) * 4;
+                } else {
+                    break;
+                }
+            }
+        } else {
+            return false;
+        }
+
+        if (key == SRC_IP_KEY) {
+            if (addr_len == 4) {
+                std::memcpy(&item.id, src, 4);
+            } else {
+                detail::KeyHash h;
+                h.add(src, 16);
+                item.id = h.value();
+            }
+        } else {
+            detail::KeyHash h;
+            h.add(src, 2 * addr_len);   // source, then destination
+            u32 ports = 0;
+            // TCP, UDP and SCTP start with both ports
+            if ((next == 6 || next == 17 || next == 132) && first_fragment
+                && l4 + 4 <= len) {
+                std::memcpy(&ports, ip + l4, 4);
+            }
+            h.add(static_cast<u64>(next) << 32 | ports);
+            item.id = h.value();
+        }
+
+        if (!hasOrigin) {
+            t0 = ticks;
+            hasOrigin = true;
+        }
+        item.value = static_cast<u32>(ticks - t0) + 1;
+        return true;
+    }
+
+    vector<FlowItem> parse_pcap(const char* filename, FlowKey key) {
+        constexpr u64 CHUNK = 1 << 16;
+        PcapReader reader(filename, key);
+        vector<FlowItem> vec;
+        u64 n = 0;
+        do {
+            vec.resize(vec.size() + CHUNK);
+            n = reader.read(vec.data() + vec.size() - CHUNK, CHUNK);
+            vec.resize(vec.size() - CHUNK + n);
+        } while (n > 0);
+        return vec;
+    }
+}   // namespace sketch
@@ -0,0 +1,88 @@
+#pragma once
+#include "sketch_defs.hpp"
+
+namespace sketch {
+    /// @brief Hardware events counted around the timed phases.
+    enum PerfEvent {
+        PERF_CYCLES,
+        PERF_INSTRUCTIONS,
+        PERF_L1D_MISSES,        ///< L1 data cache read misses.
+        PERF_LLC_MISSES,        ///< Last-level cache read misses.
+        PERF_BRANCH_MISSES,
+        PERF_DTLB_MISSES,       ///< Data TLB read misses.
+        NUM_PERF_EVENTS,
+    };
+
+    /// @brief Return the name of an event.
+    inline const char* perf_event_name(u32 event);
+
+    /// @brief Event counts of some operations.
+    struct PerfCounts {
+        u64 value[NUM_PERF_EVENTS] = {};    ///< Raw counts.
+        u64 enabled[NUM_PERF_EVENTS] = {};  ///< Time each was enabled.
+        u64 running[NUM_PERF_EVENTS] = {};  ///< Time each was counting.
+        bool valid[NUM_PERF_EVENTS] = {};   ///< If the event was open.
+        u64 ops = 0;                        ///< Number of operations.
+
+        /// @brief Add the counts of other operations. An event stays
+        ///        valid only if it is valid in both.
+        inline void merge(const PerfCounts& other);
+
+        /// @brief Return if an event was counted at all.
+        inline bool counted(u32 event) const;
+
+        /// @brief Return the count of an event per operation, scaled
+        ///        up for the time it was multiplexed out.
+        inline f64 perOp(u32 event) const;
+    };
+
+    /// @brief Counters of the calling thread, read through
+    ///        perf_event_open(2).
+    /// @details Each event is opened on its own, user space only, so an
+    ///          event the CPU or the kernel refuses does not take the
+    ///          others with it. When the PMU runs out of counters, the
+    ///          kernel multiplexes them and counts are scaled by the
+    ///          time each was running. Without access, e.g. under a high
+    ///          perf_event_paranoid or in a container, no event is
+    ///          valid and the counters cost nothing.
+    class PerfCounters {
+    public:
+        PerfCounters();
+        ~PerfCounters();
+
+        PerfCounters(const PerfCounters&) = delete;
+        PerfCounters& operator=(const PerfCounters&) = delete;
+
+        /// @brief Return if any event could be opened.
+        inline bool available() const;
+
+        /// @brief Start counting a phase on the calling thread, which
+        ///        must be the one that constructed the counters.
+        inline void start();
+
+        /// @brief Stop counting a phase and add its counts.
+        /// @param counts Counts to add to.
+        /// @param ops Number of operations of the phase.
+        inline void stop(PerfCounts& counts, u64 ops);
+
+        /// @brief Return why no event could be opened, empty if any was.
+        inline const string& error() const;
+
+    private:
+        /// @brief Reading of an event, as laid out by the kernel.
+        struct Reading {
+            u64 value;
+            u64 enabled;    ///< Time the event was enabled.
+            u64 running;    ///< Time the event was counting.
+        };
+
+        int fd[NUM_PERF_EVENTS];
+        Reading begin[NUM_PERF_EVENTS];
+        string reason;
+
+        /// @brief Read an event, returning false on failure.
+        inline bool read(u32 event, Reading& reading) const;
+    };
+}   // namespace sketch
+
+#include "perf_counters_impl.hpp"
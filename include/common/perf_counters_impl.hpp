@@ -0,0 +1,165 @@
+#pragma once
+#include "perf_counters.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace sketch {
+namespace detail {
+    /// @brief Set the type and config of an event in its attributes.
+    inline void perf_event_config(u32 event, perf_event_attr& attr) {
+        auto& type = attr.type;
+        auto& config = attr.config;
+        auto cache = [](u64 id, u64 op, u64 result) {
+            return id | op << 8 | result << 16;
+        };
+        type = PERF_TYPE_HARDWARE;
+        switch (event) {
+        case PERF_CYCLES:
+            config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case PERF_INSTRUCTIONS:
+            config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case PERF_BRANCH_MISSES:
+            config = PERF_COUNT_HW_BRANCH_MISSES;
+            break;
+        case PERF_L1D_MISSES:
+            type = PERF_TYPE_HW_CACHE;
+            config = cache(PERF_COUNT_HW_CACHE_L1D,
+                           PERF_COUNT_HW_CACHE_OP_READ,
+                           PERF_COUNT_HW_CACHE_RESULT_MISS);
+            break;
+        case PERF_LLC_MISSES:
+            type = PERF_TYPE_HW_CACHE;
+            config = cache(PERF_COUNT_HW_CACHE_LL,
+                           PERF_COUNT_HW_CACHE_OP_READ,
+                           PERF_COUNT_HW_CACHE_RESULT_MISS);
+            break;
+        default:
+            type = PERF_TYPE_HW_CACHE;
+            config = cache(PERF_COUNT_HW_CACHE_DTLB,
+                           PERF_COUNT_HW_CACHE_OP_READ,
+                           PERF_COUNT_HW_CACHE_RESULT_MISS);
+            break;
+        }
+    }
+}   // namespace detail
+
+    const char* perf_event_name(u32 event) {
+        static const char* const NAMES[NUM_PERF_EVENTS] = {
+            "cycles", "instructions", "L1D misses", "LLC misses",
+            "branch misses", "dTLB misses"};
+        return NAMES[event];
+    }
+
+    void PerfCounts::merge(const PerfCounts& other) {
+        if (ops == 0) {
+            *this = other;
+            return;
+        }
+        for (u32 e = 0; e < NUM_PERF_EVENTS; ++e) {
+            value[e] += other.value[e];
+            enabled[e] += other.enabled[e];
+            running[e] += other.running[e];
+            valid[e] = valid[e] && other.valid[e];
+        }
+        ops += other.ops;
+    }
+
+    bool PerfCounts::counted(u32 event) const {
+        return valid[event] && running[event] > 0 && ops > 0;
+    }
+
+    f64 PerfCounts::perOp(u32 event) const {
+        if (!counted(event)) {
+            return 0;
+        }
+        return static_cast<f64>(value[event]) * enabled[event]
+             / running[event] / ops;
+    }
+
+    PerfCounters::PerfCounters() {
+        int last_errno = 0;
+        for (u32 e = 0; e < NUM_PERF_EVENTS; ++e) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            detail::perf_event_config(e, attr);
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+                             | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            // user space only, which perf_event_paranoid 2 still allows
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fd[e] = syscall(SYS_perf_event_open, &attr, 0, -1, -1,
+                            PERF_FLAG_FD_CLOEXEC);
+            if (fd[e] < 0) {
+                last_errno = errno;
+            }
+        }
+        if (!available()) {
+            reason = string("perf_event_open: ") + std::strerror(last_errno);
+            std::ifstream paranoid("/proc/sys/kernel/perf_event_paranoid");
+            int level;
+            if (paranoid >> level) {
+                reason += ", perf_event_paranoid is "
+                        + std::to_string(level);
+            }
+        }
+    }
+
+    PerfCounters::~PerfCounters() {
+        for (u32 e = 0; e < NUM_PERF_EVENTS; ++e) {
+            if (fd[e] >= 0) {
+                close(fd[e]);
+            }
+        }
+    }
+
+    bool PerfCounters::available() const {
+        for (u32 e = 0; e < NUM_PERF_EVENTS; ++e) {
+            if (fd[e] >= 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const string& PerfCounters::error() const {
+        return reason;
+    }
+
+    bool PerfCounters::read(u32 event, Reading& reading) const {
+        return fd[event] >= 0
+            && ::read(fd[event], &reading, sizeof(reading))
+                   == sizeof(reading);
+    }
+
+    void PerfCounters::start() {
+        // counters run all along, a phase is the difference of readings
+        for (u32 e = 0; e < NUM_PERF_EVENTS; ++e) {
+            if (!read(e, begin[e])) {
+                begin[e].running = UINT64_MAX;
+            }
+        }
+    }
+
+    void PerfCounters::stop(PerfCounts& counts, u64 ops) {
+        PerfCounts phase;
+        phase.ops = ops;
+        for (u32 e = 0; e < NUM_PERF_EVENTS; ++e) {
+            Reading end;
+            if (begin[e].running == UINT64_MAX || !read(e, end)) {
+                continue;
+            }
+            phase.value[e] = end.value - begin[e].value;
+            phase.enabled[e] = end.enabled - begin[e].enabled;
+            phase.running[e] = end.running - begin[e].running;
+            phase.valid[e] = true;
+        }
+        counts.merge(phase);
+    }
+}   // namespace sketch
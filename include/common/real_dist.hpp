@@ -1,8 +1,15 @@
 #pragma once
-#include <unordered_map>
 #include "sketch_utils.hpp"
+#include "flat_map.hpp"
 
 namespace sketch {
+    /// @brief Exact per-flow value distributions.
+    /// @details Items are buffered as they are appended, then build()
+    ///          lays the values out in compressed sparse rows: one array
+    ///          of values, grouped by flow and sorted within each flow,
+    ///          and the offset of each flow's slice. Queries are binary
+    ///          searches or lookups on the immutable slices, so they may
+    ///          run concurrently.
     class real_dist {
     public:
         /// @brief Append a given item.
@@ -10,6 +17,16 @@ namespace sketch {
         /// @param value Item value.
         inline void append(u32 id, u32 value);
 
+        /// @brief Append items in [first, last).
+        inline void append(const FlowItem* first, const FlowItem* last);
+
+        /// @brief Lay out the appended items for queries. Must be called
+        ///        once, after the last append and before any query.
+        /// @details Flows are counted, their slices allocated, values
+        ///          scattered into them, and the slices sorted in parallel.
+        /// @param thread_num Number of sorting threads, 0 for all cores.
+        inline void build(u32 thread_num = 0);
+
         /// @brief Return absolute rank of a given item.
         /// @param id Item ID.
         /// @param value Item value.
@@ -36,9 +53,21 @@ namespace sketch {
         /// @param id Flow ID.
         inline FlowType type(u32 id) const;
 
+        /// @brief Return the IDs of all flows, in order of first
+        ///        appearance.
+        inline const vec_u32& flows() const;
+
     private:
-        std::unordered_map<u32, vec_u32> container;  ///< Container.
+        vector<FlowItem> pending;   ///< Items appended before build.
+        bool built = false;         ///< If build has been called.
+        FlatMap index;              ///< Flow ID to flow index.
+        vec_u32 ids;                ///< Flow IDs by flow index.
+        vector<u64> offsets;        ///< Slice of each flow, plus the end.
+        vec_u32 values;             ///< Values, sorted within each flow.
+
+        /// @brief Return the slice of a given flow, or throw if absent.
+        inline const u32* slice(u32 id, u32& n) const;
     };
 }   // namespace sketch
 
-#include "real_dist_impl.hpp"
\ No newline at end of file
+#include "real_dist_impl.hpp"
@@ -1,16 +1,149 @@
+#pragma once
 #include "real_dist.hpp"
-#include <numeric>
-#include <cmath>
+#include "parallel.hpp"
 #include <algorithm>
-#include "vec_ops.hpp"
+#include <stdexcept>
 
 namespace sketch {
+namespace detail {
+    /// Slices at least this long are radix-sorted, shorter ones are
+    /// sorted by comparison.
+    constexpr u64 RADIX_SORT_MIN = 1024;
+
+    /// @brief Sort [first, last) by LSD radix sort on 11-bit digits,
+    ///        skipping digits all values share.
+    /// @param scratch Room for last - first values.
+    inline void radix_sort(u32* first, u32* last, u32* scratch) {
+        constexpr u32 BITS = 11;
+        constexpr u32 BUCKETS = 1 << BITS;
+        const u64 n = last - first;
+        u32* src = first;
+        u32* dst = scratch;
+        vector<u64> count(BUCKETS);
+        for (u32 shift = 0; shift < 32; shift += BITS) {
+            std::fill(count.begin(), count.end(), 0);
+            for (u64 i = 0; i < n; ++i) {
+                ++count[src[i] >> shift & (BUCKETS - 1)];
+            }
+            if (count[src[0] >> shift & (BUCKETS - 1)] == n) {
+                continue;
+            }
+            u64 sum = 0;
+            for (auto& c : count) {
+                const u64 tmp = c;
+                c = sum;
+                sum += tmp;
+            }
+            for (u64 i = 0; i < n; ++i) {
+                dst[count[src[i] >> shift & (BUCKETS - 1)]++] = src[i];
+            }
+            std::swap(src, dst);
+        }
+        if (src != first) {
+            std::copy(src, src + n, first);
+        }
+    }
+}   // namespace detail
+
     void real_dist::append(u32 id, u32 value) {
-        container[id].push_back(value);
+        if (built) {
+            throw std::logic_error("append to a built real_dist");
+        }
+        pending.push_back({id, value});
+    }
+
+    void real_dist::append(const FlowItem* first, const FlowItem* last) {
+        if (built) {
+            throw std::logic_error("append to a built real_dist");
+        }
+        pending.insert(pending.end(), first, last);
+    }
+
+    void real_dist::build(u32 thread_num) {
+        if (built) {
+            throw std::logic_error("real_dist built twice");
+        }
+        built = true;
+
+        // count, replacing each ID with its flow index on the way
+        vector<u64> count;
+        for (auto& item : pending) {
+            const u32* found = index.find(item.id);
+            u32 flow;
+            if (found != nullptr) {
+                flow = *found;
+            } else {
+                flow = ids.size();
+                index[item.id] = flow;
+                ids.push_back(item.id);
+                count.push_back(0);
+            }
+            ++count[flow];
+            item.id = flow;
+        }
+
+        const u32 flow_num = ids.size();
+        offsets.assign(flow_num + 1, 0);
+        for (u32 f = 0; f < flow_num; ++f) {
+            offsets[f + 1] = offsets[f] + count[f];
+        }
+
+        // fill
+        values.resize(pending.size());
+        for (u32 f = 0; f < flow_num; ++f) {
+            count[f] = offsets[f];
+        }
+        for (const auto& item : pending) {
+            values[count[item.id]++] = item.value;
+        }
+        vector<FlowItem>().swap(pending);
+
+        // Sort slices in parallel. Threads take contiguous flow ranges of
+        // about equal numbers of values, found by binary search on the
+        // offsets.
+        const u64 n = values.size();
+        thread_num = detail::thread_count(n, thread_num);
+        detail::run_threads(thread_num, [&](u32 t) {
+            auto flow_at = [&](u64 pos) {
+                return static_cast<u32>(
+                    std::lower_bound(offsets.begin(), offsets.end(), pos)
+                    - offsets.begin());
+            };
+            const u32 first = flow_at(n * t / thread_num);
+            const u32 last = t + 1 == thread_num
+                           ? flow_num : flow_at(n * (t + 1) / thread_num);
+            vec_u32 scratch;
+            for (u32 f = first; f < last; ++f) {
+                u32* begin = values.data() + offsets[f];
+                u32* end = values.data() + offsets[f + 1];
+                const u64 len = offsets[f + 1] - offsets[f];
+                if (len < detail::RADIX_SORT_MIN) {
+                    std::sort(begin, end);
+                    continue;
+                }
+                if (scratch.size() < len) {
+                    scratch.resize(len);
+                }
+                detail::radix_sort(begin, end, scratch.data());
+            }
+        });
+    }
+
+    const u32* real_dist::slice(u32 id, u32& n) const {
+        const u32* flow = index.find(id);
+        if (flow == nullptr) {
+            throw std::out_of_range("unknown flow");
+        }
+        n = offsets[*flow + 1] - offsets[*flow];
+        return values.data() + offsets[*flow];
     }
 
     u32 real_dist::rank(u32 id, u32 value, bool inclusive) const {
-        return vec_rank(container.at(id), value, inclusive);
+        u32 n;
+        const u32* first = slice(id, n);
+        const u32* pos = inclusive ? std::upper_bound(first, first + n, value)
+                                   : std::lower_bound(first, first + n, value);
+        return pos - first;
     }
 
     f64 real_dist::nomRank(u32 id, u32 value, bool inclusive) const {
@@ -22,16 +155,17 @@ namespace sketch {
             throw std::invalid_argument("normalized rank out of range");
         }
 
-        u64 tmp = nom_rank * size(id) - inclusive;
-        u32 idx = inclusive ? std::ceil(tmp) : tmp;
-
-        auto& vec = const_cast<real_dist*>(this)->container.at(id);
-        std::nth_element(vec.begin(), vec.begin() + idx, vec.end());
-        return vec[idx];
+        u32 n;
+        const u32* first = slice(id, n);
+        f64 pos = nom_rank * n - inclusive;
+        u64 idx = pos > 0 ? static_cast<u64>(pos) : 0;
+        return first[std::min<u64>(idx, n - 1)];
     }
 
     u32 real_dist::size(u32 id) const {
-        return container.at(id).size();
+        u32 n;
+        slice(id, n);
+        return n;
     }
 
     FlowType real_dist::type(u32 id) const {
@@ -40,4 +174,8 @@ namespace sketch {
         else if (sz <= 255) return MID;
         else return HUGE;
     }
-}   // namespace sketch
\ No newline at end of file
+
+    const vec_u32& real_dist::flows() const {
+        return ids;
+    }
+}   // namespace sketch
@@ -0,0 +1,62 @@
+#pragma once
+#include "sketch_defs.hpp"
+
+namespace sketch {
+namespace simd {
+    /// @brief Instruction set a kernel table is built for.
+    enum SimdLevel {
+        SCALAR,
+        SSE4,
+        AVX2,
+        NUM_LEVELS,
+    };
+
+    /// @brief Table of kernels compiled for one instruction set.
+    /// @details All arrays are plain pointers with explicit lengths, so
+    ///          the kernels can be used on vectors and inline storage
+    ///          alike.
+    struct KernelTable {
+        SimdLevel level;    ///< Instruction set of the table.
+
+        /// @brief Union of two sorted f64 arrays, with the same
+        ///        semantics as @c std::set_union.
+        /// @return Number of items written into @c out, which must have
+        ///         room for @c na + @c nb items.
+        u32 (*union_f64)(const f64* a, u32 na, const f64* b, u32 nb,
+                         f64* out);
+        /// @brief Union of two sorted u32 arrays, see @c union_f64.
+        u32 (*union_u32)(const u32* a, u32 na, const u32* b, u32 nb,
+                         u32* out);
+
+        /// @brief Index of the first item in a sorted f64 array that is
+        ///        not less than @c key.
+        u32 (*lower_bound_f64)(const f64* a, u32 n, f64 key);
+        /// @brief Index of the first item in a sorted u32 array that is
+        ///        not less than @c key.
+        u32 (*lower_bound_u32)(const u32* a, u32 n, u32 key);
+
+        /// @brief dst[i] = min(dst[i], src[i]) for i in [0, n).
+        void (*min_u32)(u32* dst, const u32* src, u32 n);
+        /// @brief dst[i] = dst[i] + src[i] for i in [0, n).
+        void (*add_u32)(u32* dst, const u32* src, u32 n);
+    };
+
+    /// @brief Return the best instruction set supported by the CPU.
+    inline SimdLevel detect();
+
+    /// @brief Return if kernels of a given level can run on this CPU.
+    inline bool supported(SimdLevel level);
+
+    /// @brief Return the kernel table of a given level.
+    /// @warning The caller must make sure the level is @c supported.
+    inline const KernelTable& kernelsFor(SimdLevel level);
+
+    /// @brief Return the kernel table selected at startup via CPUID.
+    inline const KernelTable& kernels();
+
+    /// @brief Return the name of a given level.
+    inline const char* levelName(SimdLevel level);
+}   // namespace simd
+}   // namespace sketch
+
+#include "simd_kernels_impl.hpp"
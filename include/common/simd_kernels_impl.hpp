@@ -0,0 +1,385 @@
+#pragma once
+#include "simd_kernels.hpp"
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define M4_SIMD_X86 1
+#include <immintrin.h>
+#else
+#define M4_SIMD_X86 0
+#endif
+
+namespace sketch {
+namespace simd {
+namespace detail {
+    /// Sorted arrays are narrowed down by binary search to a window of
+    /// this size, which is then scanned linearly.
+    constexpr u32 LB_WINDOW = 32;
+
+    /// @brief Narrow a sorted array down to a window containing
+    ///        the lower bound of @c key.
+    /// @param n Array length, set to the window length on return.
+    /// @return Offset of the window, the lower bound lies in
+    ///         [offset, offset + n].
+    template <typename T>
+    inline u32 lb_narrow(const T* a, u32& n, T key) {
+        u32 base = 0;
+        while (n > LB_WINDOW) {
+            u32 half = n / 2;
+            if (a[base + half] < key) {
+                base += half + 1;
+                n -= half + 1;
+            } else {
+                n = half;
+            }
+        }
+        return base;
+    }
+
+    /// @brief Merge the rest of two sorted arrays starting at a[i], b[j]
+    ///        into out[k], with the same semantics as @c std::set_union.
+    template <typename T>
+    inline u32 union_tail(const T* a, u32 na, const T* b, u32 nb, T* out,
+                          u32 i, u32 j, u32 k) {
+        while (i < na && j < nb) {
+            T x = a[i], y = b[j];
+            bool lt = x < y, gt = y < x;
+            out[k++] = gt ? y : x;
+            i += !gt;
+            j += !lt;
+        }
+        out = std::copy(a + i, a + na, out + k);
+        std::copy(b + j, b + nb, out);
+        return k + (na - i) + (nb - j);
+    }
+
+    /// Branchless merge steps the vector unions take after a block
+    /// compare fails, before comparing blocks again. It bounds the cost
+    /// of compares on interleaved arrays, and is no more than the block
+    /// width, so the steps cannot run past either array.
+    constexpr u32 UNION_STEPS = 4;
+
+    /// @brief Take @c UNION_STEPS merge steps of @c union_tail, given
+    ///        that a[i] and b[j] are followed by that many items.
+    template <typename T>
+    inline void union_steps(const T* a, const T* b, T* out,
+                            u32& i, u32& j, u32& k) {
+        for (u32 s = 0; s < UNION_STEPS; ++s) {
+            T x = a[i], y = b[j];
+            bool lt = x < y, gt = y < x;
+            out[k++] = gt ? y : x;
+            i += !gt;
+            j += !lt;
+        }
+    }
+
+    /// @brief Union with the structure of the vector kernels below,
+    ///        comparing blocks of UNION_STEPS items one by one.
+    template <typename T>
+    inline u32 union_scalar(const T* a, u32 na, const T* b, u32 nb,
+                            T* out) {
+        u32 i = 0, j = 0, k = 0;
+        for (; i + UNION_STEPS <= na && j + UNION_STEPS <= nb;) {
+            bool eq = true;
+            for (u32 s = 0; s < UNION_STEPS; ++s) {
+                eq &= a[i + s] == b[j + s];
+            }
+            if (eq) {
+                // then copy the rest of the equal run item by item
+                do {
+                    out[k++] = a[i++], ++j;
+                } while (i < na && j < nb && a[i] == b[j]);
+            } else {
+                union_steps(a, b, out, i, j, k);
+            }
+        }
+        return union_tail(a, na, b, nb, out, i, j, k);
+    }
+
+    template <typename T>
+    inline u32 lower_bound_scalar(const T* a, u32 n, T key) {
+        u32 base = lb_narrow(a, n, key);
+        u32 cnt = 0;
+        for (u32 i = 0; i < n; ++i) {
+            cnt += a[base + i] < key;
+        }
+        return base + cnt;
+    }
+
+    inline void min_u32_scalar(u32* dst, const u32* src, u32 n) {
+        for (u32 i = 0; i < n; ++i) {
+            dst[i] = std::min(dst[i], src[i]);
+        }
+    }
+
+    inline void add_u32_scalar(u32* dst, const u32* src, u32 n) {
+        for (u32 i = 0; i < n; ++i) {
+            dst[i] += src[i];
+        }
+    }
+
+#if M4_SIMD_X86
+    // SSE4 kernels.
+    //
+    // Unions copy a whole block when the blocks at the heads of both
+    // arrays are equal, as in histograms sharing their split points, and
+    // take UNION_STEPS branchless merge steps otherwise. Comparing blocks
+    // only every few steps keeps interleaved arrays about as fast as with
+    // the scalar merge.
+
+    __attribute__((target("sse4.2,popcnt")))
+    inline u32 union_f64_sse4(const f64* a, u32 na, const f64* b, u32 nb,
+                              f64* out) {
+        u32 i = 0, j = 0, k = 0;
+        for (; i + UNION_STEPS <= na && j + UNION_STEPS <= nb;) {
+            __m128d a0 = _mm_loadu_pd(a + i), a1 = _mm_loadu_pd(a + i + 2);
+            __m128d b0 = _mm_loadu_pd(b + j), b1 = _mm_loadu_pd(b + j + 2);
+            __m128d eq = _mm_and_pd(_mm_cmpeq_pd(a0, b0),
+                                    _mm_cmpeq_pd(a1, b1));
+            if (_mm_movemask_pd(eq) == 0x3) {
+                _mm_storeu_pd(out + k, a0);
+                _mm_storeu_pd(out + k + 2, a1);
+                i += 4, j += 4, k += 4;
+            } else {
+                union_steps(a, b, out, i, j, k);
+            }
+        }
+        return union_tail(a, na, b, nb, out, i, j, k);
+    }
+
+    __attribute__((target("sse4.2,popcnt")))
+    inline u32 union_u32_sse4(const u32* a, u32 na, const u32* b, u32 nb,
+                              u32* out) {
+        u32 i = 0, j = 0, k = 0;
+        for (; i + UNION_STEPS <= na && j + UNION_STEPS <= nb;) {
+            __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+            __m128i vb = _mm_loadu_si128((const __m128i*)(b + j));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(va, vb)) == 0xFFFF) {
+                _mm_storeu_si128((__m128i*)(out + k), va);
+                i += 4, j += 4, k += 4;
+            } else {
+                union_steps(a, b, out, i, j, k);
+            }
+        }
+        return union_tail(a, na, b, nb, out, i, j, k);
+    }
+
+    __attribute__((target("sse4.2,popcnt")))
+    inline u32 lower_bound_f64_sse4(const f64* a, u32 n, f64 key) {
+        u32 base = lb_narrow(a, n, key);
+        const __m128d vk = _mm_set1_pd(key);
+        u32 cnt = 0, i = 0;
+        for (; i + 2 <= n; i += 2) {
+            __m128d v = _mm_loadu_pd(a + base + i);
+            cnt += __builtin_popcount(_mm_movemask_pd(_mm_cmplt_pd(v, vk)));
+        }
+        for (; i < n; ++i) {
+            cnt += a[base + i] < key;
+        }
+        return base + cnt;
+    }
+
+    __attribute__((target("sse4.2,popcnt")))
+    inline u32 lower_bound_u32_sse4(const u32* a, u32 n, u32 key) {
+        u32 base = lb_narrow(a, n, key);
+        // flip the sign bit to compare unsigned values as signed ones
+        const __m128i bias = _mm_set1_epi32(INT_MIN);
+        const __m128i vk = _mm_xor_si128(_mm_set1_epi32(key), bias);
+        u32 cnt = 0, i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(a + base + i));
+            __m128i lt = _mm_cmpgt_epi32(vk, _mm_xor_si128(v, bias));
+            cnt += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(lt)));
+        }
+        for (; i < n; ++i) {
+            cnt += a[base + i] < key;
+        }
+        return base + cnt;
+    }
+
+    __attribute__((target("sse4.2,popcnt")))
+    inline void min_u32_sse4(u32* dst, const u32* src, u32 n) {
+        u32 i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+            __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_min_epu32(d, s));
+        }
+        min_u32_scalar(dst + i, src + i, n - i);
+    }
+
+    __attribute__((target("sse4.2,popcnt")))
+    inline void add_u32_sse4(u32* dst, const u32* src, u32 n) {
+        u32 i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+            __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_add_epi32(d, s));
+        }
+        add_u32_scalar(dst + i, src + i, n - i);
+    }
+
+    // AVX2 kernels, same structure as the SSE4 ones with wider blocks.
+
+    __attribute__((target("avx2,popcnt")))
+    inline u32 union_f64_avx2(const f64* a, u32 na, const f64* b, u32 nb,
+                              f64* out) {
+        u32 i = 0, j = 0, k = 0;
+        for (; i + UNION_STEPS <= na && j + UNION_STEPS <= nb;) {
+            __m256d va = _mm256_loadu_pd(a + i), vb = _mm256_loadu_pd(b + j);
+            __m256d eq = _mm256_cmp_pd(va, vb, _CMP_EQ_OQ);
+            if (_mm256_movemask_pd(eq) == 0xF) {
+                _mm256_storeu_pd(out + k, va);
+                i += 4, j += 4, k += 4;
+            } else {
+                union_steps(a, b, out, i, j, k);
+            }
+        }
+        return union_tail(a, na, b, nb, out, i, j, k);
+    }
+
+    __attribute__((target("avx2,popcnt")))
+    inline u32 union_u32_avx2(const u32* a, u32 na, const u32* b, u32 nb,
+                              u32* out) {
+        u32 i = 0, j = 0, k = 0;
+        for (; i + 8 <= na && j + 8 <= nb;) {
+            __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+            __m256i vb = _mm256_loadu_si256((const __m256i*)(b + j));
+            __m256i eq = _mm256_cmpeq_epi32(va, vb);
+            if (_mm256_movemask_epi8(eq) == -1) {
+                _mm256_storeu_si256((__m256i*)(out + k), va);
+                i += 8, j += 8, k += 8;
+            } else {
+                union_steps(a, b, out, i, j, k);
+            }
+        }
+        return union_tail(a, na, b, nb, out, i, j, k);
+    }
+
+    __attribute__((target("avx2,popcnt")))
+    inline u32 lower_bound_f64_avx2(const f64* a, u32 n, f64 key) {
+        u32 base = lb_narrow(a, n, key);
+        const __m256d vk = _mm256_set1_pd(key);
+        u32 cnt = 0, i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m256d v = _mm256_loadu_pd(a + base + i);
+            __m256d lt = _mm256_cmp_pd(v, vk, _CMP_LT_OQ);
+            cnt += __builtin_popcount(_mm256_movemask_pd(lt));
+        }
+        for (; i < n; ++i) {
+            cnt += a[base + i] < key;
+        }
+        return base + cnt;
+    }
+
+    __attribute__((target("avx2,popcnt")))
+    inline u32 lower_bound_u32_avx2(const u32* a, u32 n, u32 key) {
+        u32 base = lb_narrow(a, n, key);
+        // flip the sign bit to compare unsigned values as signed ones
+        const __m256i bias = _mm256_set1_epi32(INT_MIN);
+        const __m256i vk = _mm256_xor_si256(_mm256_set1_epi32(key), bias);
+        u32 cnt = 0, i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(a + base + i));
+            __m256i lt = _mm256_cmpgt_epi32(vk, _mm256_xor_si256(v, bias));
+            cnt += __builtin_popcount(
+                _mm256_movemask_ps(_mm256_castsi256_ps(lt)));
+        }
+        for (; i < n; ++i) {
+            cnt += a[base + i] < key;
+        }
+        return base + cnt;
+    }
+
+    __attribute__((target("avx2,popcnt")))
+    inline void min_u32_avx2(u32* dst, const u32* src, u32 n) {
+        u32 i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+            __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+            _mm256_storeu_si256((__m256i*)(dst + i), _mm256_min_epu32(d, s));
+        }
+        min_u32_scalar(dst + i, src + i, n - i);
+    }
+
+    __attribute__((target("avx2,popcnt")))
+    inline void add_u32_avx2(u32* dst, const u32* src, u32 n) {
+        u32 i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+            __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+            _mm256_storeu_si256((__m256i*)(dst + i), _mm256_add_epi32(d, s));
+        }
+        add_u32_scalar(dst + i, src + i, n - i);
+    }
+#endif
+}   // namespace detail
+
+    SimdLevel detect() {
+#if M4_SIMD_X86
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("popcnt")) {
+            return SCALAR;
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            return AVX2;
+        }
+        if (__builtin_cpu_supports("sse4.2")) {
+            return SSE4;
+        }
+#endif
+        return SCALAR;
+    }
+
+    bool supported(SimdLevel level) {
+        return level <= detect();
+    }
+
+    const KernelTable& kernelsFor(SimdLevel level) {
+        using namespace detail;
+        static const KernelTable tables[NUM_LEVELS] = {
+            {SCALAR, union_scalar<f64>, union_scalar<u32>,
+             lower_bound_scalar<f64>, lower_bound_scalar<u32>,
+             min_u32_scalar, add_u32_scalar},
+#if M4_SIMD_X86
+            {SSE4, union_f64_sse4, union_u32_sse4,
+             lower_bound_f64_sse4, lower_bound_u32_sse4,
+             min_u32_sse4, add_u32_sse4},
+            {AVX2, union_f64_avx2, union_u32_avx2,
+             lower_bound_f64_avx2, lower_bound_u32_avx2,
+             min_u32_avx2, add_u32_avx2},
+#else
+            {SCALAR, union_scalar<f64>, union_scalar<u32>,
+             lower_bound_scalar<f64>, lower_bound_scalar<u32>,
+             min_u32_scalar, add_u32_scalar},
+            {SCALAR, union_scalar<f64>, union_scalar<u32>,
+             lower_bound_scalar<f64>, lower_bound_scalar<u32>,
+             min_u32_scalar, add_u32_scalar},
+#endif
+        };
+        if (level >= NUM_LEVELS) {
+            throw std::invalid_argument("unknown simd level");
+        }
+        return tables[level];
+    }
+
+    const KernelTable& kernels() {
+        static const KernelTable& table = kernelsFor(detect());
+        return table;
+    }
+
+    const char* levelName(SimdLevel level) {
+        switch (level) {
+            case SCALAR: return "scalar";
+            case SSE4: return "sse4";
+            case AVX2: return "avx2";
+            default: break;
+        }
+        return "unknown";
+    }
+}   // namespace simd
+}   // namespace sketch
+
+#undef M4_SIMD_X86
@@ -15,6 +15,7 @@ namespace sketch {
     using i32 = int32_t;
     using u32 = uint32_t;
     using u64 = uint64_t;
+    using f32 = float;
     using f64 = double;
     using vec_f64 = vector<f64>;
     using vec_u32 = vector<u32>;
@@ -8,20 +8,50 @@
 #include <numeric>
 #include <unordered_map>
 #include "sketch_defs.hpp"
-#include "file_path.hpp"
 
 namespace sketch {
     // Random number generation.
 
-    /// @brief Generate a random bit.
-    /// @warning This function is not thread-safe.
-    inline bool rand_bit() {
-        static std::random_device rd;
-        static std::default_random_engine gen(rd());
-        static std::bernoulli_distribution dis(0.5);
-        return dis(gen);
+    /// @brief One step of splitmix64, advancing @c state.
+    inline u64 splitmix64(u64& state) {
+        u64 z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
     }
 
+    /// @brief Derive an independent seed for a given stream,
+    ///        e.g. one bucket of a sketch, from a base seed.
+    inline u64 derive_seed(u64 seed, u64 stream) {
+        u64 state = seed ^ splitmix64(stream);
+        return splitmix64(state);
+    }
+
+    /// @brief Random bit generator based on splitmix64.
+    /// @details Each 64-bit draw serves 64 coin flips. Keep one generator
+    ///          per sketch or per thread, it is not thread-safe itself.
+    struct rand_bit_generator {
+        /// @brief Construct a generator with given seed.
+        rand_bit_generator(u64 seed = 0) : state(seed), bits(0), left(0) { }
+
+        /// @brief Generate a random bit.
+        bool operator()() {
+            if (left == 0) {
+                bits = splitmix64(state);
+                left = 64;
+            }
+            bool bit = bits & 1;
+            bits >>= 1;
+            --left;
+            return bit;
+        }
+
+    private:
+        u64 state;  ///< Generator state.
+        u64 bits;   ///< Unused bits of the last draw.
+        u32 left;   ///< Number of unused bits.
+    };
+
     /// @brief Random u32 generator.
     struct rand_u32_generator {
         /// @brief Construct a generator with given seed and max value.
@@ -44,61 +74,4 @@ namespace sketch {
         return std::fabs(a - b) < 1e-5;
     }
 
-
-    vector<FlowItem> load_dataset(const string& dataset) {
-        const char* filename;
-        if(dataset=="caida") {
-            filename = caida_path;
-        } else if (dataset=="imc") {
-            filename = imc_path;
-        } else if (dataset=="MAWI") {
-            filename = mawi_path;
-        } else {
-            throw std::invalid_argument("unknown dataset");
-        }    
-
-        FILE* pf = fopen(filename, "rb");
-        if(!pf){
-            throw std::runtime_error("cannot open file");
-        }
-
-        vector<FlowItem> vec;
-        double ftime = -1;
-        long long fime = -1;
-        char trace[30];
-
-        if(filename == caida_path){
-            while(fread(trace, 1, 21, pf)){
-                uint32_t tkey = *(uint32_t*) (trace);
-                double ttime = *(double*) (trace+13);
-                if(ftime<0)ftime=ttime;
-                vec.emplace_back((FlowItem){tkey, u32((ttime-ftime)*10000000)+1});
-            }
-        }else if(filename == imc_path){
-            while(fread(trace, 1, 26, pf)){
-                uint32_t tkey = *(uint32_t*) (trace);
-                long long ttimee = *(long long*) (trace+18);
-                if(fime<0)fime=ttimee;
-                vec.emplace_back((FlowItem){tkey, u32((ttimee-fime)/100)+1});
-            }
-        }else{
-            while(fread(trace, 1, 21, pf)){
-                uint32_t tkey = *(uint32_t*) (trace);
-                long long ttime = *(long long*) (trace+13);
-                if(fime<0)fime=ttime;
-                vec.emplace_back((FlowItem){tkey, u32((ttime-fime)*100000)+1});
-            }
-        }
-        fclose(pf);
-
-        std::unordered_map<u32, u32> mp;
-        for (auto& [key, value]: vec) {
-            u32 temp = value;
-            value = std::max(1u, value - mp[key]);
-            mp[key] = temp;
-        }
-
-        return vec;
-    }
-
 } // namespace sketch
\ No newline at end of file
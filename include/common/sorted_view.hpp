@@ -37,7 +37,7 @@ namespace sketch {
         /// @param first First iterator.
         /// @param last Last iterator.
         /// @param weight Weight of each inserted item.
-        inline void insert(u32_const_iter first, u32_const_iter last, 
+        inline void insert(const u32* first, const u32* last,
                            u32 weight);
 
         /// @brief Insert items in [first, last) into the sorted view.
@@ -50,7 +50,10 @@ namespace sketch {
         /// @param weight Item weight.
         inline void insert(u32 value, u32 weight);
 
-        /// @brief Convert the sorted view to a cumulative view.
+        /// @brief Sort inserted items and convert the sorted view
+        ///        to a cumulative view.
+        /// @note Inserted items are kept unsorted until this call, which
+        ///       must precede any query.
         inline void convertToCumulative();
 
         /// @brief Estimate absolute rank of a given item.
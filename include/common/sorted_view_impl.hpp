@@ -9,31 +9,35 @@ namespace sketch {
         view.reserve(num);
     }
 
-    void SortedView::insert(u32_const_iter first, u32_const_iter last,
+    void SortedView::insert(const u32* first, const u32* last,
                              u32 weight) {
         for (auto it = first; it != last; ++it) {
-            vec_insert_ordered(view, {*it, weight}, witem::value_less);
+            view.push_back({*it, weight});
         }
     }
 
     void SortedView::insert(witem_const_iter first, witem_const_iter last) {
-        for (auto it = first; it != last; ++it) {
-            vec_insert_ordered(view, *it, witem::value_less);
-        }
+        view.insert(view.end(), first, last);
     }
 
     void SortedView::insert(u32 value, u32 weight) {
-        vec_insert_ordered(view, {value, weight}, witem::value_less);
+        view.push_back({value, weight});
     }
 
     void SortedView::convertToCumulative() {
+        // Items are inserted unsorted, sort them once here.
+        std::sort(view.begin(), view.end(), witem::value_less);
+
         // Merge items with same value.
+        u32 n = 0;
         for (u32 i = 0; i < view.size(); ++i) {
-            while (i + 1 < view.size() && view[i].value == view[i + 1].value) {
-                view[i].weight += view[i + 1].weight;
-                view.erase(view.begin() + i + 1);
+            if (n > 0 && view[n - 1].value == view[i].value) {
+                view[n - 1].weight += view[i].weight;
+            } else {
+                view[n++] = view[i];
             }
         }
+        view.resize(n);
 
         // Convert to cumulative view.
         totalWeight = 0;
@@ -0,0 +1,95 @@
+#pragma once
+#include "sketch_defs.hpp"
+#include "sketch_utils.hpp"
+
+namespace sketch {
+    /// @brief How packets are spread over flows.
+    enum FlowSkew {
+        ZIPF_SKEW,      ///< Weight of the i-th flow is 1 / i^alpha.
+        PARETO_SKEW,    ///< Weights are Pareto quantiles of shape alpha.
+    };
+
+    /// @brief Shape of the values of a flow, each flow scaling its own
+    ///        copy by a log-uniform factor in [10, 10^5].
+    enum ValueDist {
+        EXP_DIST,           ///< Exponential.
+        LOGNORMAL_DIST,     ///< Lognormal of sigma 1.
+        BIMODAL_DIST,       ///< Narrow lognormals at 0.2 (90%) and 8.2.
+    };
+
+    /// @brief Parameters of a synthetic trace.
+    struct SynthConfig {
+        u64 items = 10000000;       ///< Number of items.
+        u32 flows = 1 << 20;        ///< Number of flows.
+        FlowSkew skew = ZIPF_SKEW;
+        f64 alpha = 0;              ///< Skew, 0 for 1.0 (Zipf), 1.2 (Pareto).
+        ValueDist dist = LOGNORMAL_DIST;
+        u64 seed = 1;
+    };
+
+    /// @brief Parse the parameters of a synthetic trace.
+    /// @param spec Comma-separated key=value pairs among items, flows,
+    ///        skew (zipf, pareto), alpha, dist (exp, lognormal, bimodal)
+    ///        and seed, e.g. "items=1e9,skew=pareto". Missing keys keep
+    ///        their defaults.
+    inline SynthConfig parse_synth(const string& spec);
+
+    /// @brief Generator of a synthetic trace of per-flow inter-arrival
+    ///        times.
+    /// @details Flows are drawn from an alias table and values from an
+    ///          inverse-CDF table with linear interpolation, the last
+    ///          bucket being computed exactly to keep the tail. Both
+    ///          draws of an item come from a hash of the seed and the
+    ///          item's position, so any range of the trace is generated
+    ///          independently and the trace is the same however it is
+    ///          split into chunks or threads.
+    class SynthTrace {
+    public:
+        /// @brief Constructor, which builds the tables.
+        explicit SynthTrace(const SynthConfig& config);
+
+        /// @brief Generate the items at positions [first, first + n).
+        inline void generate(u64 first, u64 n, FlowItem* out) const;
+
+        /// @brief Generate the next items of the trace.
+        /// @return Number of items generated, 0 at the end.
+        inline u64 read(FlowItem* out, u64 max);
+
+        /// @brief Return the number of items of the trace.
+        inline u64 size() const;
+
+    private:
+        static constexpr u32 QUANTILE_BITS = 12;
+        static constexpr u32 QUANTILE_NUM = 1 << QUANTILE_BITS;
+        static constexpr u32 SCALE_NUM = 64;
+
+        /// @brief Entry of the alias table of flows.
+        struct Alias {
+            u32 threshold;  ///< Keep the bucket below this, out of 2^32.
+            u32 alias;      ///< Flow taken otherwise.
+        };
+
+        SynthConfig config;
+        vector<Alias> aliases;
+        vec_f64 quantiles;          ///< Unit quantiles at k / QUANTILE_NUM.
+        f64 scales[SCALE_NUM];      ///< Per-flow scale factors.
+        u64 next = 0;               ///< Position of the next read.
+
+        /// @brief Return the quantile of the unit value distribution.
+        inline f64 quantile(f64 q) const;
+
+        /// @brief Return the value of an item from a unit draw, scaled
+        ///        by its flow.
+        inline u32 toValue(f64 unit, u32 id) const;
+
+        /// @brief Return the ID of a flow, a bijection of its index.
+        inline u32 flowId(u32 flow) const;
+    };
+
+    /// @brief Generate a whole synthetic trace.
+    /// @param thread_num Number of threads, 0 for all cores.
+    inline vector<FlowItem> generate_trace(const SynthConfig& config,
+                                           u32 thread_num = 0);
+}   // namespace sketch
+
+#include "synth_impl.hpp"
@@ -0,0 +1,298 @@
+#pragma once
+#include "synth.hpp"
+#include "parallel.hpp"
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace sketch {
+namespace detail {
+    /// @brief Inverse of the standard normal CDF, by Acklam's rational
+    ///        approximation, with relative error below 1.2e-9.
+    inline f64 inv_normal(f64 q) {
+        static constexpr f64 a[] = {-3.969683028665376e+01,
+            2.209460984245205e+02, -2.759285104469687e+02,
+            1.383577518672690e+02, -3.066479806614716e+01,
+            2.506628277459239e+00};
+        static constexpr f64 b[] = {-5.447609879822406e+01,
+            1.615858368580409e+02, -1.556989798598866e+02,
+            6.680131188771972e+01, -1.328068155288572e+01};
+        static constexpr f64 c[] = {-7.784894002430293e-03,
+            -3.223964580411365e-01, -2.400758277161838e+00,
+            -2.549732539343734e+00, 4.374664141464968e+00,
+            2.938163982698783e+00};
+        static constexpr f64 d[] = {7.784695709041462e-03,
+            3.224671290700398e-01, 2.445134137142996e+00,
+            3.754408661907416e+00};
+        constexpr f64 LOW = 0.02425;
+
+        if (q <= 0) {
+            return -std::numeric_limits<f64>::infinity();
+        }
+        if (q < LOW || q > 1 - LOW) {
+            const f64 t = std::sqrt(-2 * std::log(q < LOW ? q : 1 - q));
+            const f64 x = (((((c[0] * t + c[1]) * t + c[2]) * t + c[3]) * t
+                            + c[4]) * t + c[5])
+                        / ((((d[0] * t + d[1]) * t + d[2]) * t + d[3]) * t
+                           + 1);
+            return q < LOW ? x : -x;
+        }
+        const f64 t = q - 0.5;
+        const f64 r = t * t;
+        return (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r
+                + a[5]) * t
+             / (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r
+                + 1);
+    }
+
+    /// @brief CDF of the bimodal unit distribution, a mixture of
+    ///        lognormals of sigma 0.3 and means 0.2 (90%) and 8.2.
+    inline f64 bimodal_cdf(f64 x) {
+        constexpr f64 SIGMA = 0.3;
+        const f64 mu_low = std::log(0.2) - SIGMA * SIGMA / 2;
+        const f64 mu_high = std::log(8.2) - SIGMA * SIGMA / 2;
+        auto normal_cdf = [](f64 z) {
+            return 0.5 * std::erfc(-z / std::sqrt(2.0));
+        };
+        const f64 lx = std::log(x);
+        return 0.9 * normal_cdf((lx - mu_low) / SIGMA)
+             + 0.1 * normal_cdf((lx - mu_high) / SIGMA);
+    }
+
+    /// @brief murmur3 finalizer, a bijection of u32.
+    inline u32 fmix32(u32 h) {
+        h ^= h >> 16;
+        h *= 0x85ebca6bU;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35U;
+        h ^= h >> 16;
+        return h;
+    }
+}   // namespace detail
+
+    SynthConfig parse_synth(const string& spec) {
+        SynthConfig config;
+        u64 start = 0;
+        while (start < spec.size()) {
+            u64 end = spec.find(',', start);
+            if (end == string::npos) {
+                end = spec.size();
+            }
+            const string pair = spec.substr(start, end - start);
+            start = end + 1;
+            const u64 eq = pair.find('=');
+            if (eq == string::npos) {
+                throw std::invalid_argument("synth parameter without value");
+            }
+            const string key = pair.substr(0, eq);
+            const string value = pair.substr(eq + 1);
+            if (key == "items") {
+                const f64 items = std::stod(value);
+                if (items < 1 || items > 1e18) {
+                    throw std::invalid_argument("bad synth items");
+                }
+                config.items = static_cast<u64>(items);
+            } else if (key == "flows") {
+                const f64 flows = std::stod(value);
+                if (flows < 1 || flows > UINT32_MAX) {
+                    throw std::invalid_argument("bad synth flows");
+                }
+                config.flows = static_cast<u32>(flows);
+            } else if (key == "skew") {
+                if (value == "zipf") {
+                    config.skew = ZIPF_SKEW;
+                } else if (value == "pareto") {
+                    config.skew = PARETO_SKEW;
+                } else {
+                    throw std::invalid_argument("bad synth skew");
+                }
+            } else if (key == "alpha") {
+                config.alpha = std::stod(value);
+                if (!(config.alpha > 0)) {
+                    throw std::invalid_argument("bad synth alpha");
+                }
+            } else if (key == "dist") {
+                if (value == "exp") {
+                    config.dist = EXP_DIST;
+                } else if (value == "lognormal") {
+                    config.dist = LOGNORMAL_DIST;
+                } else if (value == "bimodal") {
+                    config.dist = BIMODAL_DIST;
+                } else {
+                    throw std::invalid_argument("bad synth dist");
+                }
+            } else if (key == "seed") {
+                config.seed = std::stoull(value);
+            } else {
+                throw std::invalid_argument("unknown synth parameter");
+            }
+        }
+        return config;
+    }
+
+    SynthTrace::SynthTrace(const SynthConfig& config_)
+        : config(config_), aliases(config_.flows),
+          quantiles(QUANTILE_NUM + 1) {
+        const u32 flows = config.flows;
+        if (flows == 0) {
+            throw std::invalid_argument("synthetic trace without flows");
+        }
+        f64 alpha = config.alpha;
+        if (alpha == 0) {
+            alpha = config.skew == ZIPF_SKEW ? 1.0 : 1.2;
+        }
+
+        // Vose's alias method on the flow weights, scaled to mean 1
+        vec_f64 prob(flows);
+        f64 sum = 0;
+        for (u32 i = 0; i < flows; ++i) {
+            // pow takes most of the table time, so the default Zipf
+            // skew of 1 divides instead
+            if (config.skew == PARETO_SKEW) {
+                prob[i] = std::pow((i + 0.5) / flows, -1 / alpha);
+            } else if (alpha == 1) {
+                prob[i] = 1 / (i + 1.0);
+            } else {
+                prob[i] = std::pow(i + 1.0, -alpha);
+            }
+            sum += prob[i];
+        }
+        vec_u32 small, large;
+        small.reserve(flows);
+        large.reserve(flows);
+        for (u32 i = 0; i < flows; ++i) {
+            prob[i] *= flows / sum;
+            (prob[i] < 1 ? small : large).push_back(i);
+        }
+        while (!small.empty() && !large.empty()) {
+            const u32 s = small.back();
+            const u32 l = large.back();
+            small.pop_back();
+            aliases[s] = {static_cast<u32>(prob[s] * 4294967296.0), l};
+            prob[l] -= 1 - prob[s];
+            if (prob[l] < 1) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // the rest have probability 1, up to rounding
+        for (u32 i : large) {
+            aliases[i] = {UINT32_MAX, i};
+        }
+        for (u32 i : small) {
+            aliases[i] = {UINT32_MAX, i};
+        }
+
+        for (u32 k = 0; k < QUANTILE_NUM; ++k) {
+            quantiles[k] = quantile(static_cast<f64>(k) / QUANTILE_NUM);
+        }
+        // the last bucket is computed exactly, this only keeps the
+        // interpolation in bounds
+        quantiles[QUANTILE_NUM] = quantiles[QUANTILE_NUM - 1];
+        for (u32 j = 0; j < SCALE_NUM; ++j) {
+            scales[j] = 10 * std::pow(10.0, 4.0 * j / (SCALE_NUM - 1));
+        }
+    }
+
+    f64 SynthTrace::quantile(f64 q) const {
+        if (q <= 0) {
+            return 0;
+        }
+        switch (config.dist) {
+        case EXP_DIST:
+            return -std::log1p(-q);
+        case LOGNORMAL_DIST:
+            return std::exp(-0.5 + detail::inv_normal(q));
+        default: {
+            // bisect the mixture CDF in log space
+            f64 lo = std::log(1e-6), hi = std::log(1e6);
+            for (u32 i = 0; i < 64; ++i) {
+                const f64 mid = (lo + hi) / 2;
+                (detail::bimodal_cdf(std::exp(mid)) < q ? lo : hi) = mid;
+            }
+            return std::exp((lo + hi) / 2);
+        }
+        }
+    }
+
+    u32 SynthTrace::flowId(u32 flow) const {
+        const u32 salt = static_cast<u32>(config.seed * 0x9e3779b9U);
+        return detail::fmix32(flow + salt);
+    }
+
+    void SynthTrace::generate(u64 first, u64 n, FlowItem* out) const {
+        constexpr u64 BATCH = 64;
+        const u64 flows = config.flows;
+        // two splitmix64 draws per item, from the item's position on
+        u64 state = derive_seed(config.seed, 0)
+                  + 2 * first * 0x9e3779b97f4a7c15ULL;
+        const Alias* alias = aliases.data();
+        const f64* quant = quantiles.data();
+        u64 r1[BATCH], r2[BATCH];
+        for (u64 i = 0; i < n; i += BATCH) {
+            const u64 m = std::min(BATCH, n - i);
+            // draw a batch ahead and prefetch its alias entries, as a
+            // large table misses the cache on every item
+            for (u64 j = 0; j < m; ++j) {
+                r1[j] = splitmix64(state);
+                r2[j] = splitmix64(state);
+                __builtin_prefetch(&alias[(r1[j] >> 32) * flows >> 32]);
+            }
+            for (u64 j = 0; j < m; ++j) {
+                const u32 bucket = (r1[j] >> 32) * flows >> 32;
+                const Alias& a = alias[bucket];
+                // branch-free, the coin is unpredictable
+                const u32 keep = -static_cast<u32>(
+                    static_cast<u32>(r1[j]) < a.threshold);
+                const u32 id = flowId((bucket & keep) | (a.alias & ~keep));
+
+                const u32 k = r2[j] >> (64 - QUANTILE_BITS);
+                const f64 frac = static_cast<u32>(r2[j]) * 0x1p-32;
+                const f64 unit = quant[k] + (quant[k + 1] - quant[k]) * frac;
+                out[i + j] = {id, toValue(unit, id)};
+            }
+            // Redo the last bucket exactly. It is rare, and keeping the
+            // call out of the loop above keeps that loop in registers.
+            for (u64 j = 0; j < m; ++j) {
+                const u32 k = r2[j] >> (64 - QUANTILE_BITS);
+                if (k + 1 == QUANTILE_NUM) {
+                    const f64 frac = static_cast<u32>(r2[j]) * 0x1p-32;
+                    FlowItem& item = out[i + j];
+                    item.value = toValue(quantile((k + frac) / QUANTILE_NUM),
+                                         item.id);
+                }
+            }
+        }
+    }
+
+    u32 SynthTrace::toValue(f64 unit, u32 id) const {
+        const f64 value = unit * scales[id >> 26];
+        return static_cast<u32>(std::min(value, 4e9)) + 1;
+    }
+
+    u64 SynthTrace::read(FlowItem* out, u64 max) {
+        const u64 n = std::min(max, config.items - next);
+        generate(next, n, out);
+        next += n;
+        return n;
+    }
+
+    u64 SynthTrace::size() const {
+        return config.items;
+    }
+
+    vector<FlowItem> generate_trace(const SynthConfig& config,
+                                    u32 thread_num) {
+        const SynthTrace trace(config);
+        const u64 n = trace.size();
+        vector<FlowItem> vec(n);
+        thread_num = detail::thread_count(n, thread_num);
+        const u64 chunk = (n + thread_num - 1) / thread_num;
+        detail::run_threads(thread_num, [&](u32 t) {
+            const u64 first = std::min(n, t * chunk);
+            const u64 last = std::min(n, first + chunk);
+            trace.generate(first, last - first, vec.data() + first);
+        });
+        return vec;
+    }
+}   // namespace sketch
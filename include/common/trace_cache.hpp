@@ -0,0 +1,34 @@
+#pragma once
+#include "sketch_defs.hpp"
+
+namespace sketch {
+    /// @brief Write flow items to a columnar cache file.
+    /// @details The file holds a header, then an @c id column and a
+    ///          @c value column in group varint encoding, where a tag
+    ///          byte gives the byte lengths of the next 4 values, so
+    ///          decoding takes no branch per byte. IDs are replaced with
+    ///          their index in a dictionary of flows, in order of first
+    ///          appearance, when that is smaller. Both columns are split
+    ///          into blocks of a fixed number of items, whose offsets are
+    ///          indexed so blocks decode independently. The file is
+    ///          written aside and renamed into place, so a reader never
+    ///          sees it half-written.
+    /// @param filename Path of the cache file.
+    /// @param items Items to be written, usually inter-arrival times.
+    inline void write_cache(const char* filename,
+                            const vector<FlowItem>& items);
+
+    /// @brief Read flow items from a columnar cache file.
+    /// @details The file is memory-mapped and its blocks are decoded in
+    ///          parallel. Throws if the file is not a valid cache.
+    /// @param filename Path of the cache file.
+    /// @param thread_num Number of decoding threads, 0 for all cores.
+    inline vector<FlowItem> read_cache(const char* filename,
+                                       u32 thread_num = 0);
+
+    /// @brief Return if a cache file exists and is no older than its
+    ///        source file.
+    inline bool cache_fresh(const char* cache_name, const char* source_name);
+}   // namespace sketch
+
+#include "trace_cache_impl.hpp"
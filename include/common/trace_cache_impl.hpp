@@ -0,0 +1,249 @@
+#pragma once
+#include "trace_cache.hpp"
+#include "flat_map.hpp"
+#include "mapped_file.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <sys/stat.h>
+
+namespace sketch {
+namespace detail {
+    constexpr char CACHE_MAGIC[8] = {'M', '4', 'C', 'A', 'C', 'H', 'E', 1};
+    constexpr u64 CACHE_BLOCK = 1 << 16;    ///< Items per block.
+    constexpr u32 CACHE_ID_DICT = 1;        ///< IDs are dictionary indices.
+
+    /// @brief Header of a cache file, followed by the block index as u64
+    ///        pairs of column offsets, the dictionary as u32, the id
+    ///        column and the value column.
+    struct CacheHeader {
+        char magic[8];
+        u32 flags;
+        u32 dictNum;        ///< Number of dictionary entries.
+        u64 itemNum;
+        u64 idBytes;        ///< Size of the id column.
+        u64 valueBytes;     ///< Size of the value column.
+    };
+
+    inline u32 varint_size(u32 v) {
+        return 1 + (v >= 1u << 8) + (v >= 1u << 16) + (v >= 1u << 24);
+    }
+
+    /// @brief Append a group of 4 values: a tag byte with 2 bits of byte
+    ///        length minus 1 per value, then the low bytes of each.
+    inline void put_group(vector<u8>& out, const u32* v) {
+        u8 tag = 0;
+        for (u32 k = 0; k < 4; ++k) {
+            tag |= (varint_size(v[k]) - 1) << (2 * k);
+        }
+        out.push_back(tag);
+        for (u32 k = 0; k < 4; ++k) {
+            for (u32 b = 0; b < varint_size(v[k]); ++b) {
+                out.push_back(static_cast<u8>(v[k] >> (8 * b)));
+            }
+        }
+    }
+
+    /// @brief Decode a group of 4 values at @c p, or throw if it runs
+    ///        into the last 3 bytes before @c end, which a column holds
+    ///        as padding for the loads of 4 bytes past a short value.
+    inline const u8* get_group(const u8* p, const u8* end, u32* v) {
+        static constexpr u32 MASK[4] = {0xff, 0xffff, 0xffffff, 0xffffffff};
+        if (p == end) {
+            throw std::runtime_error("corrupt cache column");
+        }
+        const u32 tag = *p++;
+        // total length of the group is 4 + sum of the 2-bit fields
+        const u32 len = 4 + (tag & 3) + (tag >> 2 & 3) + (tag >> 4 & 3)
+                          + (tag >> 6);
+        if (static_cast<u64>(end - p) < len + 3) {
+            throw std::runtime_error("corrupt cache column");
+        }
+        for (u32 k = 0; k < 4; ++k) {
+            const u32 width = tag >> (2 * k) & 3;
+            u32 x;
+            std::memcpy(&x, p, 4);
+            v[k] = x & MASK[width];
+            p += width + 1;
+        }
+        return p;
+    }
+}   // namespace detail
+
+    void write_cache(const char* filename, const vector<FlowItem>& items) {
+        const u64 n = items.size();
+        const u64 block_num = (n + detail::CACHE_BLOCK - 1)
+                            / detail::CACHE_BLOCK;
+
+        // index of each ID in order of first appearance
+        FlatMap index;
+        vec_u32 dict;
+        vec_u32 ids(n);
+        u64 raw_bytes = 0;
+        u64 dict_bytes = 0;
+        for (u64 i = 0; i < n; ++i) {
+            const u32 id = items[i].id;
+            const u32* found = index.find(id);
+            if (found == nullptr) {
+                index[id] = dict.size();
+                ids[i] = dict.size();
+                dict.push_back(id);
+            } else {
+                ids[i] = *found;
+            }
+            raw_bytes += detail::varint_size(id);
+            dict_bytes += detail::varint_size(ids[i]);
+        }
+        detail::CacheHeader header = {};
+        std::memcpy(header.magic, detail::CACHE_MAGIC, sizeof(header.magic));
+        if (dict_bytes + 4 * dict.size() < raw_bytes) {
+            header.flags |= detail::CACHE_ID_DICT;
+        } else {
+            dict.clear();
+            for (u64 i = 0; i < n; ++i) {
+                ids[i] = items[i].id;
+            }
+        }
+        header.dictNum = dict.size();
+        header.itemNum = n;
+
+        vector<u64> block_index(2 * block_num);
+        vector<u8> id_col, value_col;
+        id_col.reserve(n + (header.flags & detail::CACHE_ID_DICT
+                            ? dict_bytes : raw_bytes) / 4 + 4);
+        value_col.reserve(3 * n);
+        for (u64 i = 0; i < n; i += 4) {
+            if (i % detail::CACHE_BLOCK == 0) {
+                block_index[2 * (i / detail::CACHE_BLOCK)] = id_col.size();
+                block_index[2 * (i / detail::CACHE_BLOCK) + 1]
+                    = value_col.size();
+            }
+            // a short last group is padded with zeros
+            u32 id_group[4] = {0, 0, 0, 0};
+            u32 value_group[4] = {0, 0, 0, 0};
+            for (u64 k = 0; k < 4 && i + k < n; ++k) {
+                id_group[k] = ids[i + k];
+                value_group[k] = items[i + k].value;
+            }
+            detail::put_group(id_col, id_group);
+            detail::put_group(value_col, value_group);
+        }
+        // room for the overreads of get_group
+        id_col.resize(id_col.size() + 3, 0);
+        value_col.resize(value_col.size() + 3, 0);
+        header.idBytes = id_col.size();
+        header.valueBytes = value_col.size();
+
+        const string tmp_name = string(filename) + ".tmp";
+        FILE* pf = fopen(tmp_name.c_str(), "wb");
+        if (!pf) {
+            throw std::runtime_error("cannot create cache file");
+        }
+        bool ok = fwrite(&header, sizeof(header), 1, pf) == 1
+            && fwrite(block_index.data(), 8, block_index.size(), pf)
+                   == block_index.size()
+            && fwrite(dict.data(), 4, dict.size(), pf) == dict.size()
+            && fwrite(id_col.data(), 1, id_col.size(), pf) == id_col.size()
+            && fwrite(value_col.data(), 1, value_col.size(), pf)
+                   == value_col.size();
+        ok = fclose(pf) == 0 && ok;
+        if (!ok || std::rename(tmp_name.c_str(), filename) != 0) {
+            std::remove(tmp_name.c_str());
+            throw std::runtime_error("cannot write cache file");
+        }
+    }
+
+    vector<FlowItem> read_cache(const char* filename, u32 thread_num) {
+        detail::MappedFile file(filename);
+        detail::CacheHeader header;
+        if (file.size() < sizeof(header)) {
+            throw std::runtime_error("not a cache file");
+        }
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (std::memcmp(header.magic, detail::CACHE_MAGIC,
+                        sizeof(header.magic)) != 0) {
+            throw std::runtime_error("not a cache file");
+        }
+        const u64 n = header.itemNum;
+        const u64 block_num = (n + detail::CACHE_BLOCK - 1)
+                            / detail::CACHE_BLOCK;
+        const u64 index_off = sizeof(header);
+        const u64 dict_off = index_off + 16 * block_num;
+        const u64 id_off = dict_off + 4 * static_cast<u64>(header.dictNum);
+        const u64 value_off = id_off + header.idBytes;
+        if (value_off + header.valueBytes != file.size()) {
+            throw std::runtime_error("corrupt cache file");
+        }
+        const bool use_dict = header.flags & detail::CACHE_ID_DICT;
+        const u32* dict = reinterpret_cast<const u32*>(file.data() + dict_off);
+        const u64* index = reinterpret_cast<const u64*>(
+            file.data() + index_off);
+        const u8* ids = reinterpret_cast<const u8*>(file.data() + id_off);
+        const u8* values = reinterpret_cast<const u8*>(
+            file.data() + value_off);
+
+        vector<FlowItem> vec(n);
+        thread_num = detail::thread_count(n, thread_num);
+        const u64 blocks_per_thread = (block_num + thread_num - 1)
+                                    / thread_num;
+        // An exception cannot leave a worker thread, so each thread
+        // flags its failure instead.
+        vector<u8> failed(thread_num, 0);
+        detail::run_threads(thread_num, [&](u32 t) {
+            const u64 first = std::min(block_num, t * blocks_per_thread);
+            const u64 last = std::min(block_num, first + blocks_per_thread);
+            try {
+                for (u64 b = first; b < last; ++b) {
+                    const u64 i = b * detail::CACHE_BLOCK;
+                    const u64 cnt = std::min(n - i, detail::CACHE_BLOCK);
+                    if (index[2 * b] > header.idBytes
+                        || index[2 * b + 1] > header.valueBytes) {
+                        throw std::runtime_error("corrupt cache index");
+                    }
+                    FlowItem* out = vec.data() + i;
+                    const u8* id_p = ids + index[2 * b];
+                    const u8* value_p = values + index[2 * b + 1];
+                    for (u64 k = 0; k < cnt; k += 4) {
+                        u32 id_group[4], value_group[4];
+                        id_p = detail::get_group(id_p, ids + header.idBytes,
+                                                 id_group);
+                        value_p = detail::get_group(
+                            value_p, values + header.valueBytes,
+                            value_group);
+                        for (u64 j = 0; j < 4 && k + j < cnt; ++j) {
+                            u32 id = id_group[j];
+                            if (use_dict) {
+                                if (id >= header.dictNum) {
+                                    throw std::runtime_error(
+                                        "corrupt cache dictionary index");
+                                }
+                                id = dict[id];
+                            }
+                            out[k + j] = {id, value_group[j]};
+                        }
+                    }
+                }
+            } catch (const std::exception&) {
+                failed[t] = 1;
+            }
+        });
+        if (std::find(failed.begin(), failed.end(), 1) != failed.end()) {
+            throw std::runtime_error("corrupt cache file");
+        }
+        return vec;
+    }
+
+    bool cache_fresh(const char* cache_name, const char* source_name) {
+        struct stat cache_st, source_st;
+        if (stat(cache_name, &cache_st) != 0
+            || stat(source_name, &source_st) != 0) {
+            return false;
+        }
+        const auto& c = cache_st.st_mtim;
+        const auto& s = source_st.st_mtim;
+        return c.tv_sec > s.tv_sec
+            || (c.tv_sec == s.tv_sec && c.tv_nsec >= s.tv_nsec);
+    }
+}   // namespace sketch
@@ -1,6 +1,7 @@
 #pragma once
 #include "sketch_utils.hpp"
 #include <algorithm>
+#include "simd_kernels.hpp"
 
 namespace sketch {
     /// @brief Insert an item to an ordered vector while maintaining the order.
@@ -14,6 +15,14 @@ namespace sketch {
         vec.insert(it, item);
     }
 
+    /// @brief Insert an item to an ordered u32 vector while maintaining
+    ///        the order, locating the position with the SIMD kernels.
+    inline void vec_insert_ordered(vec_u32& vec, u32 item) {
+        u32 pos = simd::kernels().lower_bound_u32(vec.data(), vec.size(),
+                                                  item);
+        vec.insert(vec.begin() + pos, item);
+    }
+
     /// @brief Insert an item to an ordered vector while maintaining the order.
     /// @tparam T Vector element type.
     /// @tparam Comp Comparator type.
@@ -84,4 +93,36 @@ namespace sketch {
                        std::back_inserter(res));
         return res;
     }
+
+namespace detail {
+    /// @brief Return a per-thread buffer of at least @c n items for the
+    ///        SIMD unions to write into, so that the result is allocated
+    ///        at its exact size and never zeroed.
+    template <typename T>
+    inline T* union_buffer(size_t n) {
+        thread_local vector<T> buf;
+        if (buf.size() < n) {
+            buf.resize(n);
+        }
+        return buf.data();
+    }
+}   // namespace detail
+
+    /// @brief Return the union of two ordered f64 vectors,
+    ///        computed by the SIMD kernels.
+    inline vec_f64 vec_union(const vec_f64& v1, const vec_f64& v2) {
+        f64* buf = detail::union_buffer<f64>(v1.size() + v2.size());
+        u32 n = simd::kernels().union_f64(v1.data(), v1.size(),
+                                          v2.data(), v2.size(), buf);
+        return vec_f64(buf, buf + n);
+    }
+
+    /// @brief Return the union of two ordered u32 vectors,
+    ///        computed by the SIMD kernels.
+    inline vec_u32 vec_union(const vec_u32& v1, const vec_u32& v2) {
+        u32* buf = detail::union_buffer<u32>(v1.size() + v2.size());
+        u32 n = simd::kernels().union_u32(v1.data(), v1.size(),
+                                          v2.data(), v2.size(), buf);
+        return vec_u32(buf, buf + n);
+    }
 }   // namespace sketch
\ No newline at end of file
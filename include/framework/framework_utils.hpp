@@ -1,21 +1,139 @@
 #pragma once
+#include <tuple>
 #include "../common/sketch_defs.hpp"
+#include "../common/simd_kernels.hpp"
 #include "../meta/dd/ddsketch.hpp"
 #include "../meta/mreq/mreq_sketch.hpp"
 #include "../meta/tdigest/tdigest.hpp"
 
 namespace sketch {
-#ifdef TEST_DD
-    DDSketch createMeta(u32 cap, f64 alpha, u32, u32) {
-        return DDSketch(cap, alpha);
+    /// METAs known to the frameworks, each with its MetaTraits.
+    using MetaList = std::tuple<DDSketch, mReqSketch, TDigest>;
+
+    /// @brief How the frameworks build and combine a META, specialized
+    ///        for each of MetaList.
+    /// @details A specialization provides
+    ///          - @c model and @c name, which identify the META;
+    ///          - sized<cap, cmtor_cap, delta>, the type of a META
+    ///            holding up to cap items in compactors of cmtor_cap
+    ///            items, or in centroids of a t-digest of the given
+    ///            delta, which is META itself unless it sizes its storage
+    ///            at compile time;
+    ///          - create(cap, alpha, cmtor_cap, delta, seed), which
+    ///            builds a META from the arguments it uses among those
+    ///            of all METAs;
+    ///          - min(vec, pos, n), the 'minimum' of the METAs
+    ///            vec[pos[0]], ..., vec[pos[n - 1]] as a histogram.
+    template <typename META>
+    struct MetaTraits;
+
+namespace detail {
+    /// @brief Minimum of METAs through their cached histograms, which
+    ///        are read in place rather than copied.
+    template <typename META>
+    inline Histogram histogram_min(const vector<META>& vec, const u32* pos,
+                                   u32 n) {
+        if (n == 1) {
+            return vec[pos[0]].histogram();
+        }
+        Histogram hist = vec[pos[0]].histogram() & vec[pos[1]].histogram();
+        for (u32 i = 2; i < n; ++i) {
+            hist = hist & vec[pos[i]].histogram();
+        }
+        return hist;
     }
-#elif defined(TEST_MREQ)
-    mReqSketch createMeta(u32 cap, f64, u32 cmtor_cap, u32) {
-        return mReqSketch(cap, cmtor_cap);
+}   // namespace detail
+
+    template <>
+    struct MetaTraits<DDSketch> {
+        static constexpr MetaModel model = DD;
+        static constexpr const char* name = "dd";
+
+        template <u32 CAP, u32 CMTOR_CAP, u32 DELTA>
+        using sized = DDSketch;
+
+        static DDSketch create(u32 cap, f64 alpha, u32, u32, u64) {
+            return DDSketch(cap, alpha);
+        }
+
+        /// DDSketches of the same alpha share their intervals, so the
+        /// minimum is taken on counters before building one histogram.
+        static Histogram min(const vector<DDSketch>& vec, const u32* pos,
+                             u32 n) {
+            DDSketch res = vec[pos[0]];
+            auto& cnters = res.counters;
+            for (u32 i = 1; i < n; ++i) {
+                const auto& temp = vec[pos[i]];
+                simd::kernels().min_u32(cnters.data(), temp.counters.data(),
+                                        cnters.size());
+            }
+            return static_cast<Histogram>(res);
+        }
+    };
+
+    /// Any mReqSketchN, the item storage of which is sized at compile
+    /// time.
+    template <u32 MAX_CMTORS, u32 MAX_ITEMS>
+    struct MetaTraits<mReqSketchN<MAX_CMTORS, MAX_ITEMS>> {
+        using META = mReqSketchN<MAX_CMTORS, MAX_ITEMS>;
+
+        static constexpr MetaModel model = MREQ;
+        static constexpr const char* name = "mreq";
+
+        template <u32 CAP, u32 CMTOR_CAP, u32 DELTA>
+        using sized = mReqSketchFor<CAP, CMTOR_CAP>;
+
+        static META create(u32 cap, f64, u32 cmtor_cap, u32, u64 seed) {
+            return META(cap, cmtor_cap, seed);
+        }
+
+        static Histogram min(const vector<META>& vec, const u32* pos,
+                             u32 n) {
+            return detail::histogram_min(vec, pos, n);
+        }
+    };
+
+    /// Any TDigestN, the centroid storage of which is sized at compile
+    /// time.
+    template <u32 MAX_DELTA>
+    struct MetaTraits<TDigestN<MAX_DELTA>> {
+        using META = TDigestN<MAX_DELTA>;
+
+        static constexpr MetaModel model = TD;
+        static constexpr const char* name = "tdigest";
+
+        template <u32 CAP, u32 CMTOR_CAP, u32 DELTA>
+        using sized = TDigestN<DELTA>;
+
+        static META create(u32 cap, f64, u32, u32 delta, u64) {
+            return META(cap, delta);
+        }
+
+        static Histogram min(const vector<META>& vec, const u32* pos,
+                             u32 n) {
+            return detail::histogram_min(vec, pos, n);
+        }
+    };
+
+    /// @brief Tag carrying a META type, to pass it to generic lambdas.
+    template <typename META>
+    struct MetaTag {
+        using type = META;
+    };
+
+namespace detail {
+    template <typename F, typename... METAs>
+    inline bool visit_meta(const string& name, F& fn, std::tuple<METAs...>*) {
+        return ((name == MetaTraits<METAs>::name
+                 ? (fn(MetaTag<METAs>()), true) : false) || ...);
     }
-#elif defined(TEST_TD)
-    TDigest createMeta(u32 cap, f64, u32, u32 delta) {
-        return TDigest(cap, delta);
+}   // namespace detail
+
+    /// @brief Call fn(MetaTag<META>()) for the META of MetaList with a
+    ///        given name.
+    /// @return If there is such a META.
+    template <typename F>
+    inline bool visit_meta(const string& name, F fn) {
+        return detail::visit_meta(name, fn, static_cast<MetaList*>(nullptr));
     }
-#endif
 }   // namespace sketch
@@ -2,22 +2,33 @@
 #include "../../common/BOBHash32.h"
 #include "../../common/tiny_counter.hpp"
 #include "../../common/histogram.hpp"
+#include "../framework_utils.hpp"
+#include "m4_config.hpp"
+#include <iterator>
+#include <tuple>
+#include <type_traits>
 
 namespace sketch {
     template <typename META>
     class SketchSingleTest;
 
-    template <typename META>
+    template <typename META, typename CONFIG = M4Config>
     class M4 {
         using vec_tiny = std::vector<TinyCnter>;
-        using vec_meta = std::vector<META>;
 
     public:
+        /// Maximum number of hash functions per level.
+        static constexpr u32 MAX_HASH_NUM = 8;
+
         /// @brief Constructor.
         /// @param mem_limit Memory limit in bytes.
-        /// @param hash_num Number of hash functions per level, by default 2.
+        /// @param hash_num Number of hash functions per level, no more
+        ///                 than MAX_HASH_NUM, by default 2. It must be
+        ///                 CONFIG::HASH_NUM if that is not 0.
         /// @param seed Seed for generating hash functions, by default 0.
-        M4(u64 mem_limit, u32 hash_num = 2, u32 seed = 0);
+        M4(u64 mem_limit, u32 hash_num = CONFIG::HASH_NUM ? CONFIG::HASH_NUM
+                                                         : 2,
+           u32 seed = 0);
 
         /// @brief Append a given item into the sketch.
         /// @param id Item ID.
@@ -34,67 +45,101 @@ namespace sketch {
         /// @brief Estimate the quantile value of a given normalized rank.
         /// @param id Item ID.
         /// @param nom_rank Normalized rank.
+        /// @note Queries are thread-safe as long as no item is appended.
         inline u32 quantile(u32 id, f64 nom_rank) const;
 
-        /// @brief Return the type of a given flow.
+        /// @brief Return the type of a given flow from the level it is
+        ///        queried at: TINY for the tiny counters, HUGE for the
+        ///        last level, and MID for the levels in between.
         /// @param id Flow ID.
         inline FlowType type(u32 id) const;
 
 
     private:
         // MetaModel metaType; ///< Meta sketch type.
-        static constexpr u32 LEVELS = 4;      ///< Number of levels.
-
-        static constexpr u32 cap[4] = {3, UINT8_MAX, UINT16_MAX, UINT32_MAX};
-        static constexpr f64 alpha[4] = {0, 0.5, 0.5, 0.3};
-        static constexpr u32 cmtor_cap[4] = {0, 2, 2, 4};
-        static constexpr u32 td_cap[4] = {0, 4, 8, 16};
-        static constexpr f64 mem_div[4] = {0.03, 0.60, 0.35, 0.02};
-
-        vec_tiny lv0;   ///< Level 0.
-        vec_meta lv1;   ///< Level 1.
-        vec_meta lv2;   ///< Level 2.
-        vec_meta lv3;   ///< Level 3.
-        std::vector<BOBHash32> hash[LEVELS];    ///< Hash functions.
-        mutable vec_u32 hashVal[LEVELS];        ///< Hash values.
+        /// Number of levels, the tiny counters and the META levels.
+        static constexpr u32 LEVELS = 1 + std::size(CONFIG::META_LEVELS);
+        /// Room for hash functions per level.
+        static constexpr u32 HASH_CAP = CONFIG::HASH_NUM ? CONFIG::HASH_NUM
+                                                         : MAX_HASH_NUM;
+        static_assert(HASH_CAP <= MAX_HASH_NUM, "too many hash functions");
+
+        /// META of a level from 1 on, sized for the level if it sizes
+        /// its storage at compile time. Level 0 maps to level 1, only so
+        /// that vec_level can name it.
+        template <u32 L>
+        using level_meta = typename MetaTraits<META>::template sized<
+            CONFIG::META_LEVELS[L == 0 ? 0 : L - 1].cap,
+            CONFIG::META_LEVELS[L == 0 ? 0 : L - 1].cmtorCap,
+            CONFIG::META_LEVELS[L == 0 ? 0 : L - 1].tdCap>;
+
+        /// Container of a level, tiny counters for level 0.
+        template <u32 L>
+        using vec_level = std::conditional_t<L == 0, vec_tiny,
+                                             std::vector<level_meta<L>>>;
+
+        template <u32... L>
+        static std::tuple<vec_level<L>...>
+        levelTuple(std::integer_sequence<u32, L...>);
+
+        /// Containers of all levels.
+        using level_tuple = decltype(
+            levelTuple(std::make_integer_sequence<u32, LEVELS>()));
+
+        level_tuple levels;                     ///< Levels.
+        BOBHash32 hash[LEVELS][HASH_CAP];       ///< Hash functions.
+        u32 hashNum;                            ///< Hash functions per level.
+
+        /// @brief Bucket positions of a flow in each level. It is a
+        ///        per-call context on the stack, so that concurrent
+        ///        queries share no state and reach no heap indirection.
+        struct HashVal {
+            u32 val[LEVELS][HASH_CAP];
+        };
+
+        /// @brief Return the number of hash functions per level, a
+        ///        constant if the configuration fixes it.
+        inline u32 hashCount() const;
 
         /// @brief Calculate hash values for a given item.
-        inline void calcHash(u32 id) const;
+        inline void calcHash(u32 id, HashVal& hv) const;
 
         // Level granularity functions.
 
         /// @brief Append a given item into lv0 (tiny counter level).
-        inline void appendTiny(u32 id, u32 value);
-        /// @brief Append a given item into lv1, 2, or 3 (dd level).
-        inline void appendMETA(u32 level, u32 id, u32 value);
-
-        /// @brief Estimate absolute rank in a given dd level.
-        inline u32 rank(u32 level, u32 id, u32 value, bool inclusive) const;
+        inline void appendTiny(const HashVal& hv, u32 value);
+        /// @brief Append a given item into a META level.
+        template <u32 L>
+        inline void appendMETA(const HashVal& hv, u32 value);
 
-        /// @brief Calculate the appending level of a given flow.
-        inline u32 calcAppendLevel(u32 id) const;
         /// @brief Calculate the query level of a given flow.
-        inline u32 calcQueryLevel(u32 id) const;
+        inline u32 calcQueryLevel(const HashVal& hv) const;
 
-        inline Histogram doMIN(u32 level, u32 id) const;
-        inline Histogram doSUM(u32 id) const;
+        template <u32 L>
+        inline Histogram doMIN(const HashVal& hv) const;
+        inline Histogram doSUM(const HashVal& hv) const;
 
         // Little helper functions.
 
         /// @brief Get container by level.
-        inline vec_meta& getVecMETA(u32 level);
+        template <u32 L>
+        inline vec_level<L>& level();
         /// @brief Get container by level.
-        inline const vec_meta& getVecMETA(u32 level) const;
+        template <u32 L>
+        inline const vec_level<L>& level() const;
 
         /// @brief Check if buckets of a given flow are all full
         ///        in a given level.
-        inline bool isAllFull(u32 level, u32 id) const;
+        template <u32 L>
+        inline bool isAllFull(const HashVal& hv) const;
 
-        inline bool hasAnyFull(u32 level, u32 id) const;
+        template <u32 L>
+        inline bool hasAnyFull(const HashVal& hv) const;
 
         /// @brief Check if any bucket of a given flow is empty
         ///        in a given level.
-        inline bool hasAnyEmpty(u32 level, u32 id) const;
+        template <u32 L>
+        inline bool hasAnyEmpty(const HashVal& hv) const;
     };
 }   // namespace sketch
 
@@ -0,0 +1,70 @@
+#pragma once
+#include "../../common/sketch_defs.hpp"
+#include <cstddef>
+#include <utility>
+
+namespace sketch {
+    /// @brief Parameters of a META level of M4.
+    struct M4Level {
+        u32 cap;        ///< Capacity of each META.
+        f64 alpha;      ///< Argument alpha of DDSketch.
+        u32 cmtorCap;   ///< Compactor capacity of mReqSketch.
+        u32 tdCap;      ///< Argument delta of TDigest.
+        f64 memDiv;     ///< Share of the memory limit.
+    };
+
+    /// @brief Level configuration of M4, that of the paper: tiny
+    ///        counters, then 3 levels of METAs.
+    /// @details A configuration is any type with the same members.
+    ///          Level 0 is always made of tiny counters and the others
+    ///          of METAs, one per entry of META_LEVELS, so M4 has
+    ///          1 + size of META_LEVELS levels. The shares of memory
+    ///          should add up to no more than 1.
+    struct M4Config {
+        /// Number of hash functions per level, 0 to give it at run time.
+        static constexpr u32 HASH_NUM = 0;
+        /// Share of the memory limit of the tiny counters.
+        static constexpr f64 TINY_MEM_DIV = 0.03;
+        /// Parameters of the META levels, from level 1 on.
+        static constexpr M4Level META_LEVELS[] = {
+            {UINT8_MAX, 0.5, 2, 4, 0.60},
+            {UINT16_MAX, 0.5, 2, 8, 0.35},
+            {UINT32_MAX, 0.3, 4, 16, 0.02},
+        };
+    };
+
+    /// @brief A configuration with a number of hash functions fixed at
+    ///        compile time, so that loops over them unroll.
+    template <typename CONFIG, u32 N>
+    struct M4FixedHash : CONFIG {
+        static_assert(N > 0, "a fixed hash number must be positive");
+        static constexpr u32 HASH_NUM = N;
+    };
+
+namespace detail {
+    template <typename F, u32... I>
+    inline void static_for(F&& fn, std::integer_sequence<u32, I...>) {
+        (fn(std::integral_constant<u32, I>()), ...);
+    }
+
+    template <typename F, u32... I>
+    inline bool static_any(F&& fn, std::integer_sequence<u32, I...>) {
+        return (fn(std::integral_constant<u32, I>()) || ...);
+    }
+
+    /// @brief Call fn(std::integral_constant<u32, I>()) for I in [0, N),
+    ///        unrolled at compile time.
+    template <u32 N, typename F>
+    inline void static_for(F&& fn) {
+        static_for(fn, std::make_integer_sequence<u32, N>());
+    }
+
+    /// @brief Call fn(std::integral_constant<u32, I>()) for I in [0, N)
+    ///        until one returns true, unrolled at compile time.
+    /// @return If any call returned true.
+    template <u32 N, typename F>
+    inline bool static_any(F&& fn) {
+        return static_any(fn, std::make_integer_sequence<u32, N>());
+    }
+}   // namespace detail
+}   // namespace sketch
@@ -4,296 +4,253 @@
 #include <cmath>
 #include <algorithm>
 #include <type_traits>
-#include "../framework_utils.hpp"
 
 namespace sketch {
-    template <typename META>
-    M4<META>::M4(u64 mem_limit, u32 hash_num, u32 seed) {
-        // calculate bucket number per level
-        TinyCnter tmp_lv0;
-        META tmp[4];
-        for (u32 i = 1; i < 4; ++i) {
-            tmp[i] = createMeta(cap[i], alpha[i], cmtor_cap[i], td_cap[i]);
+    template <typename META, typename CONFIG>
+    M4<META, CONFIG>::M4(u64 mem_limit, u32 hash_num, u32 seed) {
+        if (hash_num == 0 || hash_num > HASH_CAP
+            || (CONFIG::HASH_NUM != 0 && hash_num != CONFIG::HASH_NUM)) {
+            throw std::invalid_argument("M4 hash number out of range");
         }
 
+        // calculate bucket number per level
+        TinyCnter tmp_lv0;
         u32 bucket_num[LEVELS];
-        bucket_num[0] = mem_limit * mem_div[0] / tmp_lv0.memory();
-        for (u32 i = 1; i < 4; ++i) {
-            bucket_num[i] = mem_limit * mem_div[i] / tmp[i].memory();
-        }
+        bucket_num[0] = mem_limit * CONFIG::TINY_MEM_DIV / tmp_lv0.memory();
+        detail::static_for<LEVELS - 1>([&](auto i) {
+            const M4Level& lv = CONFIG::META_LEVELS[i];
+            using traits = MetaTraits<level_meta<i + 1>>;
+            auto tmp = traits::create(lv.cap, lv.alpha, lv.cmtorCap,
+                                      lv.tdCap, seed);
+            bucket_num[i + 1] = mem_limit * lv.memDiv / tmp.memory();
+        });
 
         // allocate memory
+        auto& lv0 = level<0>();
         lv0.reserve(bucket_num[0]);
-        lv1.reserve(bucket_num[1]);
-        lv2.reserve(bucket_num[2]);
-        lv3.reserve(bucket_num[3]);
-
         while (bucket_num[0]--) { lv0.emplace_back(); }
-        while (bucket_num[1]--) { lv1.push_back(tmp[1]); }
-        while (bucket_num[2]--) { lv2.push_back(tmp[2]); }
-        while (bucket_num[3]--) { lv3.push_back(tmp[3]); }
+        // each bucket gets its own random stream derived from seed
+        detail::static_for<LEVELS - 1>([&](auto i) {
+            constexpr u32 L = i + 1;
+            const M4Level& lv = CONFIG::META_LEVELS[i];
+            auto& vec = level<L>();
+            vec.reserve(bucket_num[L]);
+            for (u32 j = 0; j < bucket_num[L]; ++j) {
+                u64 stream = (static_cast<u64>(L) << 32) | j;
+                vec.push_back(MetaTraits<level_meta<L>>::create(
+                    lv.cap, lv.alpha, lv.cmtorCap, lv.tdCap,
+                    derive_seed(seed, stream)));
+            }
+        });
 
         // initialize hash
+        hashNum = hash_num;
         rand_u32_generator gen(seed, MAX_PRIME32 - 1);
         for (u32 i = 0; i < LEVELS; ++i) {
-            hash[i].reserve(hash_num);
-            hashVal[i].reserve(hash_num);
             for (u32 j = 0; j < hash_num; ++j) {
-                hash[i].emplace_back(gen());
-                hashVal[i].emplace_back(0);
+                hash[i][j].initialize(gen());
             }
         }
     }
 
-    template <typename META>
-    u32 M4<META>::memory() const {
+    template <typename META, typename CONFIG>
+    u32 M4<META, CONFIG>::memory() const {
         u32 mem = 0;
-        mem += lv0.size() * lv0.front().memory();
-        mem += lv1.size() * lv1.front().memory();
-        mem += lv2.size() * lv2.front().memory();
-        mem += lv3.size() * lv3.front().memory();
+        detail::static_for<LEVELS>([&](auto i) {
+            const auto& vec = level<i>();
+            mem += vec.size() * vec.front().memory();
+        });
         return mem;
     }
 
-    template <typename META>
-    void M4<META>::append(u32 id, u32 value) {
-        u32 level = calcAppendLevel(id);
-        if (level == 0) {
-            appendTiny(id, value);
-        } else {
-            appendMETA(level, id, value);
+    template <typename META, typename CONFIG>
+    void M4<META, CONFIG>::append(u32 id, u32 value) {
+        HashVal hv;
+        calcHash(id, hv);
+
+        // append to the first level with room for the flow
+        const bool appended = detail::static_any<LEVELS>([&](auto i) {
+            if (hasAnyFull<i>(hv) && !hasAnyEmpty<i>(hv)) {
+                return false;
+            }
+            if constexpr (i == 0) {
+                appendTiny(hv, value);
+            } else {
+                appendMETA<i>(hv, value);
+            }
+            return true;
+        });
+        if (!appended) {
+            throw::runtime_error("the whole META DiffSketch is full");
         }
     }
 
-    template <typename META>
-    void M4<META>::appendTiny(u32 id, u32 value) {
-        const auto& hv = hashVal[0];
-        for (u32 i = 0; i < hv.size(); ++i) {
-            u32 pos = hv[i] / 4;
-            u32 idx = hv[i] % 4;
+    template <typename META, typename CONFIG>
+    void M4<META, CONFIG>::appendTiny(const HashVal& hv, u32 value) {
+        auto& lv0 = level<0>();
+        for (u32 i = 0; i < hashCount(); ++i) {
+            u32 pos = hv.val[0][i] / 4;
+            u32 idx = hv.val[0][i] % 4;
             if (!lv0[pos].full(idx)) {
                 lv0[pos].append(value, idx);
             }
         }
     }
 
-    template <typename META>
-    void M4<META>::appendMETA(u32 level, u32 id, u32 value) {
-        auto& vec = getVecMETA(level);
-        const auto& hv = hashVal[level];
-        for (u32 i = 0; i < hv.size(); ++i) {
-            if (!vec[hv[i]].full()) {
-                vec[hv[i]].append(value);
+    template <typename META, typename CONFIG>
+    template <u32 L>
+    void M4<META, CONFIG>::appendMETA(const HashVal& hv, u32 value) {
+        auto& vec = level<L>();
+        const u32* pos = hv.val[L];
+        for (u32 i = 0; i < hashCount(); ++i) {
+            if (!vec[pos[i]].full()) {
+                vec[pos[i]].append(value);
             }
         }
     }
 
-    template <typename META>
-    Histogram M4<META>::doSUM(u32 id) const {
-        u32 level = calcQueryLevel(id);
+    template <typename META, typename CONFIG>
+    Histogram M4<META, CONFIG>::doSUM(const HashVal& hv) const {
+        u32 query_level = calcQueryLevel(hv);
 
-        if (level == 0) {
+        if (query_level == 0) {
             throw std::runtime_error("combine() is not supported in level 0");
         }
 
-        Histogram hist = doMIN(level, id);
-        for (u32 i = level - 1; i >= 1; --i) {
-            if (hasAnyEmpty(i, id)) {
-                continue;
+        // from the query level down to level 1
+        Histogram hist;
+        detail::static_for<LEVELS - 1>([&](auto i) {
+            constexpr u32 L = LEVELS - 1 - i;
+            if (L == query_level) {
+                hist = doMIN<L>(hv);
+            } else if (L < query_level && !hasAnyEmpty<L>(hv)) {
+                hist = hist | doMIN<L>(hv);
             }
-            hist = hist | doMIN(i, id);
-        }
+        });
 
         return hist;
     }
 
-    template <typename META>
-    u32 M4<META>::quantile(u32 id, f64 nom_rank) const {
-        return doSUM(id).quantile(nom_rank);
+    template <typename META, typename CONFIG>
+    u32 M4<META, CONFIG>::quantile(u32 id, f64 nom_rank) const {
+        HashVal hv;
+        calcHash(id, hv);
+        return doSUM(hv).quantile(nom_rank);
     }
 
-    template <typename META>
-    Histogram M4<META>::doMIN(u32 level, u32 id) const {
-        const auto& vec = getVecMETA(level);
-        const auto& hv = hashVal[level];
-        
-#ifdef TEST_DD
-        DDSketch res = vec[hv[0]];
-
-        auto& cnters = res.counters;
-
-        for (u32 i = 1; i < hv.size(); ++i) {
-            const auto& temp = vec[hv[i]];
-            for (u32 j = 0; j < cnters.size(); ++j) {
-                cnters[j] = std::min(cnters[j], temp.counters[j]);
-            }
-        }
-
-        return static_cast<Histogram>(res);
+    template <typename META, typename CONFIG>
+    template <u32 L>
+    Histogram M4<META, CONFIG>::doMIN(const HashVal& hv) const {
+        return MetaTraits<level_meta<L>>::min(level<L>(), hv.val[L],
+                                              hashCount());
+    }
 
-#else
-        Histogram hist = static_cast<Histogram>(vec[hv[0]]);
-        for (u32 i = 1; i < hv.size(); ++i) {
-            hist = hist & vec[hv[i]];
+    template <typename META, typename CONFIG>
+    u32 M4<META, CONFIG>::hashCount() const {
+        if constexpr (CONFIG::HASH_NUM != 0) {
+            return CONFIG::HASH_NUM;
+        } else {
+            return hashNum;
         }
-        
-        return hist;
-#endif
     }
 
-    template <typename META>
-    void M4<META>::calcHash(u32 id) const {
-        // This function lies in hot path.
-        // So we endure the verbose code to improve performance.
-        const u32 hash_num = hash[0].size();
-        u32 mod;
-        
-        mod = 4 * lv0.size();
-        for (u32 i = 0; i < hash_num; ++i) {
-            hashVal[0][i] = hash[0][i].run(id) % mod;
-        }
-        mod = lv1.size();
-        for (u32 i = 0; i < hash_num; ++i) {
-            hashVal[1][i] = hash[1][i].run(id) % mod;
-        }
-        mod = lv2.size();
-        for (u32 i = 0; i < hash_num; ++i) {
-            hashVal[2][i] = hash[2][i].run(id) % mod;
-        }
-        mod = lv3.size();
-        for (u32 i = 0; i < hash_num; ++i) {
-            hashVal[3][i] = hash[3][i].run(id) % mod;
-        }
+    template <typename META, typename CONFIG>
+    void M4<META, CONFIG>::calcHash(u32 id, HashVal& hv) const {
+        // This function lies in hot path, so levels are unrolled.
+        const u32 hash_num = hashCount();
+        detail::static_for<LEVELS>([&](auto l) {
+            const u32 mod = (l == 0 ? 4 : 1) * level<l>().size();
+            for (u32 i = 0; i < hash_num; ++i) {
+                hv.val[l][i] = hash[l][i].run(id) % mod;
+            }
+        });
     }
 
-    template <typename META>
-    bool M4<META>::isAllFull(u32 level, u32 id) const {
-        if (level == 0) {
-            for (u32 i = 0; i < hashVal[0].size(); ++i) {
-                u32 pos = hashVal[0][i] / 4;
-                u32 idx = hashVal[0][i] % 4;
-                if (!lv0[pos].full(idx)) {
+    template <typename META, typename CONFIG>
+    template <u32 L>
+    bool M4<META, CONFIG>::isAllFull(const HashVal& hv) const {
+        const auto& vec = level<L>();
+        for (u32 i = 0; i < hashCount(); ++i) {
+            if constexpr (L == 0) {
+                if (!vec[hv.val[0][i] / 4].full(hv.val[0][i] % 4)) {
                     return false;
                 }
-            }
-            return true;
-        }
-
-        const auto& vec = getVecMETA(level);
-        for (u32 i = 0; i < hashVal[level].size(); ++i) {
-            if (!vec[hashVal[level][i]].full()) {
+            } else if (!vec[hv.val[L][i]].full()) {
                 return false;
             }
         }
         return true;
     }
 
-    template <typename META>
-    bool M4<META>::hasAnyFull(u32 level, u32 id) const {
-        if (level == 0) {
-            for (u32 i = 0; i < hashVal[0].size(); ++i) {
-                u32 pos = hashVal[0][i] / 4;
-                u32 idx = hashVal[0][i] % 4;
-                if (lv0[pos].full(idx)) {
+    template <typename META, typename CONFIG>
+    template <u32 L>
+    bool M4<META, CONFIG>::hasAnyFull(const HashVal& hv) const {
+        const auto& vec = level<L>();
+        for (u32 i = 0; i < hashCount(); ++i) {
+            if constexpr (L == 0) {
+                if (vec[hv.val[0][i] / 4].full(hv.val[0][i] % 4)) {
                     return true;
                 }
-            }
-            return false;
-        }
-
-        const auto& vec = getVecMETA(level);
-        for (u32 i = 0; i < hashVal[level].size(); ++i) {
-            if (vec[hashVal[level][i]].full()) {
+            } else if (vec[hv.val[L][i]].full()) {
                 return true;
             }
         }
         return false;
     }
 
-    template <typename META>
-    bool M4<META>::hasAnyEmpty(u32 level, u32 id) const {
-        if (level == 0) {
-            for (u32 i = 0; i < hashVal[0].size(); ++i) {
-                u32 pos = hashVal[0][i] / 4;
-                u32 idx = hashVal[0][i] % 4;
-                if (lv0[pos].empty(idx)) {
+    template <typename META, typename CONFIG>
+    template <u32 L>
+    bool M4<META, CONFIG>::hasAnyEmpty(const HashVal& hv) const {
+        const auto& vec = level<L>();
+        for (u32 i = 0; i < hashCount(); ++i) {
+            if constexpr (L == 0) {
+                if (vec[hv.val[0][i] / 4].empty(hv.val[0][i] % 4)) {
                     return true;
                 }
-            }
-            return false;
-        }
-
-        const auto& vec = getVecMETA(level);
-        for (u32 i = 0; i < hashVal[level].size(); ++i) {
-            if (vec[hashVal[level][i]].empty()) {
+            } else if (vec[hv.val[L][i]].empty()) {
                 return true;
             }
         }
         return false;
     }
 
-    template <typename META>
-    u32 M4<META>::calcAppendLevel(u32 id) const {
-        calcHash(id);
-        for (u32 i = 0; i < LEVELS; ++i) {
-            if (!hasAnyFull(i, id) || hasAnyEmpty(i, id)) {
-                return i;
-            }
-        }
-
-        throw::runtime_error("the whole META DiffSketch is full");
-    }
-
-    template <typename META>
-    u32 M4<META>::calcQueryLevel(u32 id) const {
-        calcHash(id);
-        for (u32 i = 0; i < LEVELS; ++i) {
-            if (i != 0 && hasAnyEmpty(i, id)) {
-                return i - 1;
-            }
-            if (!hasAnyFull(i, id)) {
-                return i;
+    template <typename META, typename CONFIG>
+    u32 M4<META, CONFIG>::calcQueryLevel(const HashVal& hv) const {
+        u32 query_level = 0;
+        const bool found = detail::static_any<LEVELS>([&](auto i) {
+            if (i != 0 && hasAnyEmpty<i>(hv)) {
+                query_level = i - 1;
+                return true;
             }
+            query_level = i;
+            return !hasAnyFull<i>(hv);
+        });
+        if (!found) {
+            throw::runtime_error("the whole META DiffSketch is full");
         }
-
-        throw::runtime_error("the whole META DiffSketch is full");
+        return query_level;
     }
 
-    template <typename META>
-    auto M4<META>::getVecMETA(u32 level) -> vec_meta& {
-        switch (level) {
-            case 1: return lv1;
-            case 2: return lv2;
-            case 3: return lv3;
-        }
-
-        throw std::runtime_error(
-            "M4<META>::getVecMETA(): shouldn't reach here");
+    template <typename META, typename CONFIG>
+    template <u32 L>
+    auto M4<META, CONFIG>::level() -> vec_level<L>& {
+        return std::get<L>(levels);
     }
 
-    template <typename META>
-    auto M4<META>::getVecMETA(u32 level) const -> const vec_meta& {
-        switch (level) {
-            case 1: return lv1;
-            case 2: return lv2;
-            case 3: return lv3;
-        }
-
-        throw std::runtime_error(
-            "M4<META>::getVecMETA(): shouldn't reach here");
+    template <typename META, typename CONFIG>
+    template <u32 L>
+    auto M4<META, CONFIG>::level() const -> const vec_level<L>& {
+        return std::get<L>(levels);
     }
 
-    template <typename META>
-    FlowType M4<META>::type(u32 id) const {
-        u32 level = calcQueryLevel(id);
-        switch (level) {
-            case 0: return TINY;
-            case 1: return MID;
-            case 2: return HUGE;
-            case 3: return HUGE;
+    template <typename META, typename CONFIG>
+    FlowType M4<META, CONFIG>::type(u32 id) const {
+        HashVal hv;
+        calcHash(id, hv);
+        const u32 level = calcQueryLevel(hv);
+        if (level == 0) {
+            return TINY;
         }
-
-        throw std::runtime_error(
-            "M4<META>::getVecMETA(): shouldn't reach here");
+        return level + 1 == LEVELS ? HUGE : MID;
     }
 }   // namespace sketch
@@ -1,6 +1,7 @@
 #pragma once
 #include "../../common/BOBHash32.h"
 #include "../../common/sketch_utils.hpp"
+#include "../framework_utils.hpp"
 
 namespace sketch {
     template <typename META>
@@ -32,7 +33,12 @@ namespace sketch {
 
         static constexpr u32 HASH_NUM = 3;
 
-        vector<META> buckets[HASH_NUM];          ///< Buckets.
+        /// META of the buckets, sized for them if it sizes its storage
+        /// at compile time.
+        using bucket_meta = typename MetaTraits<META>::template sized<
+            UINT32_MAX, cmtor_cap, td_cap>;
+
+        vector<bucket_meta> buckets[HASH_NUM];   ///< Buckets.
         META dft;                                ///< Default bucket.
         vector<u32> ids[HASH_NUM];               ///< Flow IDs.
         BOBHash32 hash[HASH_NUM];                ///< Hash functions.
@@ -46,7 +52,9 @@ namespace sketch {
         /// @param id Item ID.
         inline u32 pos(u32 bucket_id, u32 id) const;
 
-        inline void evict(u32 bucket_id, u32 pos);
+        /// @brief Reset a bucket to an empty META.
+        /// @param seed Seed of the new META.
+        inline void evict(u32 bucket_id, u32 pos, u64 seed);
     };
 }   // namespace sketch
 
@@ -2,29 +2,33 @@
 #include "strawman.hpp"
 #include <type_traits>
 #include <algorithm>
-#include "../framework_utils.hpp"
 
 namespace sketch {
     template <typename META>
     Strawman<META>::Strawman(u64 mem_limit, u32 seed) {
-        dft = createMeta(UINT32_MAX, alpha, cmtor_cap, td_cap);
-        u32 bucket_num = mem_limit / (dft.memory() + sizeof(u32)) / HASH_NUM;
+        u32 bucket_mem = MetaTraits<bucket_meta>::create(UINT32_MAX, alpha,
+            cmtor_cap, td_cap, seed).memory();
+        u32 bucket_num = mem_limit / (bucket_mem + sizeof(u32)) / HASH_NUM;
         for (u32 i = 0; i < HASH_NUM; ++i) {
-            buckets[i] = vector<META>(bucket_num);
+            buckets[i] = vector<bucket_meta>(bucket_num);
             ids[i] = vector<u32>(bucket_num);
             for (u32 j = 0; j < bucket_num; ++j) {
-                evict(i, j);
+                u64 stream = (static_cast<u64>(i) << 32) | j;
+                evict(i, j, derive_seed(seed, stream));
             }
-            hash[i].initialize(seed + i);
+            // the seed picks among MAX_PRIME32 primes
+            hash[i].initialize((seed + i) % MAX_PRIME32);
         }
 
-        dft = createMeta(UINT32_MAX, 0.5, 2, 4);
+        dft = MetaTraits<META>::create(UINT32_MAX, 0.5, 2, 4,
+            derive_seed(seed, static_cast<u64>(HASH_NUM) << 32));
     }
 
     template <typename META>
-    void Strawman<META>::evict(u32 bucket_id, u32 pos) {
+    void Strawman<META>::evict(u32 bucket_id, u32 pos, u64 seed) {
         auto& sketch = buckets[bucket_id][pos];
-        sketch = createMeta(UINT32_MAX, alpha, cmtor_cap, td_cap);
+        sketch = MetaTraits<bucket_meta>::create(UINT32_MAX, alpha,
+                                                 cmtor_cap, td_cap, seed);
         ids[bucket_id][pos] = UINT32_MAX;
     }
 
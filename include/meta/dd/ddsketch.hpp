@@ -3,10 +3,11 @@
 #include "../../common/histogram.hpp"
 
 namespace sketch {
-        template <typename META>
-        class M4;
+    template <typename META>
+    struct MetaTraits;
+
     class DDSketch {
-        friend class M4<DDSketch>;
+        friend struct MetaTraits<DDSketch>;
     public:
         /// @brief Default constructor.
         /// @warning Members are potential uninitialized after construction.
@@ -2,15 +2,23 @@
 #include "../../common/sketch_utils.hpp"
 
 namespace sketch {
+    /// @brief Descriptor of one compactor in an mReqSketch.
+    /// @details Items are not owned by the compactor. They live in the
+    ///          flat item array of the sketch, in the range
+    ///          [offset, offset + size) that this descriptor records, so
+    ///          every method touching items takes that array.
     class mReqCmtor {
     public:
         /// @brief Constructor.
         /// @param lg_w_ log2 of weight of the compactor.
         /// @param cap_ Capacity of the compactor.
-        mReqCmtor(u32 lg_w_, u32 cap_);
-        
-        /// @brief Deleted default constructor.
-        mReqCmtor() = delete;
+        /// @param offset_ Offset of the compactor in the item array.
+        mReqCmtor(u32 lg_w_, u32 cap_, u32 offset_);
+
+        /// @brief Default constructor.
+        /// @warning Members are potential uninitialized after construction.
+        ///          Make sure you know what you are doing.
+        mReqCmtor() = default;
 
         /// @brief Return if the compactor is full.
         inline bool full() const;
@@ -24,41 +32,58 @@ namespace sketch {
         inline u32 weight() const;
         /// @brief Return number of bytes the compactor uses.
         inline u32 memory() const;
+        /// @brief Return offset of the compactor in the item array.
+        inline u32 offset() const;
+
+        /// @brief Move an empty compactor to a given offset.
+        inline void moveTo(u32 offset_);
 
-        /// @brief Return begin iterator.
-        inline u32_const_iter begin() const;
-        /// @brief Return end iterator.
-        inline u32_const_iter end() const;
-        /// @brief Return begin iterator.
-        inline u32_iter begin();
-        /// @brief Return end iterator.
-        inline u32_iter end();
+        /// @brief Return begin pointer.
+        inline const u32* begin(const u32* items) const;
+        /// @brief Return end pointer.
+        inline const u32* end(const u32* items) const;
 
         /// @brief Append a given item into the compactor.
+        /// @param items Item array of the sketch.
         /// @param item Item to be appended.
-        inline void append(u32 item);
+        /// @note Items are appended unsorted, and only get sorted when
+        ///       the compactor is compacted. The caller must make sure
+        ///       there is room behind the compactor.
+        inline void append(u32* items, u32 item);
 
         /// @brief Compact the compactor into another compactor.
+        /// @param items Item array of the sketch.
         /// @param next The next compactor which receives those
-        ///             compacted items.
-        inline void compact(mReqCmtor& next);
+        ///             compacted items. It must lie behind this
+        ///             compactor in the item array, and grows towards
+        ///             the front of the array.
+        /// @param coin Random bit source deciding which items survive.
+        inline void compact(u32* items, mReqCmtor& next,
+                            rand_bit_generator& coin);
 
         /// @brief Estimate absolute rank of a given item.
+        /// @param items Item array of the sketch.
         /// @param item Item to be ranked.
         /// @param inclusive If the given item is included in the rank.
-        inline u32 rank(u32 item, bool inclusive = true) const;
+        inline u32 rank(const u32* items, u32 item,
+                        bool inclusive = true) const;
 
         /// @brief Estimate weighted rank of a given item.
+        /// @param items Item array of the sketch.
         /// @param item Item to be ranked.
         /// @param inclusive If the given item is included in the rank.
-        inline u32 weightedRank(u32 item, bool inclusive = true) const;
+        inline u32 weightedRank(const u32* items, u32 item,
+                                bool inclusive = true) const;
 
+        /// Maximum capacity, offset and size of a compactor.
+        static constexpr u32 MAX_SIZE = UINT8_MAX;
 
     private:
-        u32     lg_w;      ///< Log2 of the weight of the compactor.
-        u32     cap;       ///< Capacity of the compactor.
-        vec_u32 items;     ///< Items in the compactor.
+        u8 lg_w;    ///< Log2 of the weight of the compactor.
+        u8 cap;     ///< Capacity of the compactor.
+        u8 off;     ///< Offset of the compactor in the item array.
+        u8 fill;    ///< Number of items in the compactor.
     };
 } // namespace sketch
 
-#include "mreq_compactor_impl.hpp"
\ No newline at end of file
+#include "mreq_compactor_impl.hpp"
@@ -1,12 +1,14 @@
 #pragma once
 #include "mreq_compactor.hpp"
 #include <algorithm>
-#include "../../common/vec_ops.hpp"
+#include <stdexcept>
 
 namespace sketch {
-    mReqCmtor::mReqCmtor(u32 lg_w_, u32 cap_)
-        : lg_w(lg_w_), cap(cap_) {
-        items.reserve(cap);
+    mReqCmtor::mReqCmtor(u32 lg_w_, u32 cap_, u32 offset_)
+        : lg_w(lg_w_), cap(cap_), off(offset_), fill(0) {
+        if (cap_ > MAX_SIZE || offset_ > MAX_SIZE) {
+            throw std::invalid_argument("mreq compactor out of range");
+        }
     }
 
     bool mReqCmtor::full() const {
@@ -14,7 +16,7 @@ namespace sketch {
     }
 
     u32 mReqCmtor::size() const {
-        return items.size();
+        return fill;
     }
 
     u32 mReqCmtor::capacity() const {
@@ -33,49 +35,81 @@ namespace sketch {
         return sizeof(u32) * capacity();
     }
 
-    u32_const_iter mReqCmtor::begin() const {
-        return items.begin();
+    u32 mReqCmtor::offset() const {
+        return off;
     }
 
-    u32_const_iter mReqCmtor::end() const {
-        return items.end();
+    void mReqCmtor::moveTo(u32 offset_) {
+        if (fill != 0) {
+            throw std::logic_error("move a non-empty compactor");
+        }
+        off = offset_;
     }
 
-    u32_iter mReqCmtor::begin() {
-        return items.begin();
+    const u32* mReqCmtor::begin(const u32* items) const {
+        return items + off;
     }
 
-    u32_iter mReqCmtor::end() {
-        return items.end();
+    const u32* mReqCmtor::end(const u32* items) const {
+        return items + off + fill;
     }
 
-    void mReqCmtor::append(u32 item) {
+    void mReqCmtor::append(u32* items, u32 item) {
         if (full()) {
             throw std::logic_error("append to a full compactor");
         }
-        vec_insert_ordered(items, item);
+        items[off + fill++] = item;
     }
 
-    void mReqCmtor::compact(mReqCmtor& next) {
+    void mReqCmtor::compact(u32* items, mReqCmtor& next,
+                            rand_bit_generator& coin) {
         if (!full()) {
             throw std::logic_error("compact a non-full compactor");
         }
+        u32* first = items + off;
+        u32* last = first + fill;
+        if (!std::is_sorted(first, last)) {
+            std::sort(first, last);
+        }
 
-        // output coin, coin+2, coin+4, ... into next compactor
-        bool coin = rand_bit();
-        for (u32 i = coin; i < size(); i += 2) {
-            vec_insert_ordered(next.items, items[i]);
+        // output coin, coin+2, coin+4, ... into a small buffer
+        u32 survivors[(MAX_SIZE + 1) / 2];
+        u32 n = 0;
+        for (u32 i = coin(); i < fill; i += 2) {
+            survivors[n++] = first[i];
         }
 
+        // Merge them from the front into the next compactor, which grows
+        // towards the front into the space this compactor frees. Writes
+        // never overtake unread items of the next compactor.
+        u32* dst = items + next.off - n;
+        const u32* src = items + next.off;
+        const u32* src_end = src + next.fill;
+        for (u32 i = 0; i < n; ) {
+            if (src != src_end && *src < survivors[i]) {
+                *dst++ = *src++;
+            } else {
+                *dst++ = survivors[i++];
+            }
+        }
+        next.off -= n;
+        next.fill += n;
+
         // clear this compactor
-        items.clear();
+        fill = 0;
     }
 
-    u32 mReqCmtor::rank(u32 item, bool inclusive) const {
-        return vec_rank(items, item, inclusive);
+    u32 mReqCmtor::rank(const u32* items, u32 item, bool inclusive) const {
+        // items may be unsorted, so count instead of searching
+        u32 rk = 0;
+        for (const u32* it = begin(items); it != end(items); ++it) {
+            rk += *it < item || (inclusive && *it == item);
+        }
+        return rk;
     }
 
-    u32 mReqCmtor::weightedRank(u32 item, bool inclusive) const {
-        return rank(item, inclusive) * weight();
+    u32 mReqCmtor::weightedRank(const u32* items, u32 item,
+                                bool inclusive) const {
+        return rank(items, item, inclusive) * weight();
     }
-} // namespace sketch
\ No newline at end of file
+} // namespace sketch
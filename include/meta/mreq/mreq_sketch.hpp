@@ -2,24 +2,64 @@
 #include "mreq_compactor.hpp"
 #include "../../common/sorted_view.hpp"
 #include "../../common/histogram.hpp"
+#include "../../common/parallel.hpp"
+#include <memory>
+#include <type_traits>
 
 namespace sketch {
-    class mReqSketch {
-        using vec_cmtor = vector<mReqCmtor>;
+namespace detail {
+    /// @brief Return the number of compactors an mReqSketch needs, the
+    ///        least n such that
+    ///        cmtor_cap * (1 + 2 + ... + 2 ^ (n - 1)) >= sketch_cap.
+    constexpr u32 mreq_cmtor_num(u32 sketch_cap, u32 cmtor_cap) {
+        if (cmtor_cap == 0) {
+            return UINT32_MAX;
+        }
+        u32 n = 0;
+        for (u64 held = 0; held < sketch_cap; held = 2 * held + cmtor_cap) {
+            ++n;
+        }
+        return n;
+    }
+}   // namespace detail
+
+    /// @brief mReqSketch with room for up to MAX_CMTORS_ compactors and
+    ///        MAX_ITEMS_ items in total, see mReqSketch.
+    /// @note The sketch is not trivially copyable: it owns its query
+    ///       cache through a pointer and guards it with a lock. Only its
+    ///       items, State, are plain data, which copies as a memcpy.
+    template <u32 MAX_CMTORS_, u32 MAX_ITEMS_>
+    class mReqSketchN {
+        static_assert(MAX_ITEMS_ <= mReqCmtor::MAX_SIZE,
+                      "compactor offsets cannot address MAX_ITEMS items");
+        static_assert(MAX_CMTORS_ >= 1 && MAX_CMTORS_ <= 32,
+                      "compactor weights 2^i must fit in u32");
+
     public:
         /// @brief Constructor.
-        /// @param sketch_cap_ Capacity of the sketch. 
+        /// @param sketch_cap_ Capacity of the sketch.
         /// @param cmtor_cap_ Capacity of each compactor.
-        mReqSketch(u32 sketch_cap_, u32 cmtor_cap_);
+        /// @param seed_ Seed of the random bits used in compaction.
+        /// @throw std::invalid_argument If the compactors do not fit in
+        ///        MAX_CMTORS and MAX_ITEMS.
+        mReqSketchN(u32 sketch_cap_, u32 cmtor_cap_, u64 seed_ = 0);
 
         /// @brief Destructor.
-        ~mReqSketch() = default;
+        ~mReqSketchN() = default;
 
         /// @brief Default constructor.
         /// @warning Members are potential uninitialized after construction.
         ///          Make sure you know what you are doing.
-        mReqSketch() = default;
-        
+        mReqSketchN() = default;
+
+        /// @brief Copy constructor, which copies the items but not the
+        ///        query cache.
+        mReqSketchN(const mReqSketchN& other);
+
+        /// @brief Copy assignment, which copies the items but not the
+        ///        query cache.
+        inline mReqSketchN& operator=(const mReqSketchN& other);
+
         /// @brief Return size of the sketch.
         inline u32 size() const;
         /// @brief Return if the sketch is empty.
@@ -37,7 +77,7 @@ namespace sketch {
         /// @param item Item to be ranked.
         /// @param inclusive If the item is included in the rank.
         inline u32 rank(u32 item, bool inclusive) const;
-        
+
         /// @brief Estimate normalized rank of a given item.
         /// @param item Item to be ranked.
         /// @param inclusive If the item is included in the rank.
@@ -46,20 +86,73 @@ namespace sketch {
         /// @brief Estimate the quantile value of a given normalized rank.
         /// @param nom_rank Normalized rank.
         /// @param inclusive If the given rank is included.
+        /// @note Queries are thread-safe as long as no item is appended.
         inline u32 quantile(f64 nom_rank, bool inclusive = true) const;
 
         /// @brief Convert the sketch into a histogram.
         inline operator Histogram() const;
 
+        /// @brief Return the cached histogram of the sketch, building it
+        ///        if the sketch changed since it was built.
+        /// @note The reference stays valid until the next append.
+        inline const Histogram& histogram() const;
+
+        /// Maximum number of compactors.
+        static constexpr u32 MAX_CMTORS = MAX_CMTORS_;
+        /// Maximum number of items, i.e. compactor number times
+        /// compactor capacity.
+        static constexpr u32 MAX_ITEMS = MAX_ITEMS_;
+
     private:
-        u32 itemNum;               ///< Number of items in the sketch.
-        u32 sketchCap;             ///< Capacity of the sketch.
-        vec_cmtor cmtors;          ///< Compactors.
-        u32 minItem = UINT32_MAX;  ///< Minimum item in the sketch.
-        u32 maxItem = 0;           ///< Maximum item in the sketch.
-        
+        /// @brief Items of the sketch and what describes them, plain
+        ///        data so that copying them is a memcpy, unlike copying
+        ///        the sketch with its query cache.
+        struct State {
+            u32 itemNum;               ///< Number of items in the sketch.
+            u32 sketchCap;             ///< Capacity of the sketch.
+            u32 cmtorNum;              ///< Number of compactors.
+            u32 minItem = UINT32_MAX;  ///< Minimum item in the sketch.
+            u32 maxItem = 0;           ///< Maximum item in the sketch.
+            rand_bit_generator coin;   ///< Random bits used in compaction.
+
+            /// Compactors, i.e. offsets and fill counts in @c items.
+            /// Compactor 0 grows from the front of @c items, the others
+            /// are packed at the back, and the free space lies in
+            /// between.
+            mReqCmtor cmtors[MAX_CMTORS];
+            u32 items[MAX_ITEMS];      ///< Items of all compactors.
+        };
+        static_assert(std::is_trivially_copyable_v<State>,
+                      "mreq sketch state must be trivially copyable");
+
+        State st;   ///< Items of the sketch.
+
+        // Query cache, dropped by an append. It lies out of line, so that
+        // it takes no room in sketches never queried. Each part is built
+        // by the first query that needs it: quantile() the cumulative
+        // view, histogram() the histogram, so a framework querying only
+        // one way keeps only one of them.
+        mutable std::unique_ptr<SortedView> view;  ///< Cached view.
+        mutable std::unique_ptr<Histogram> hist;   ///< Cached histogram.
+        mutable detail::SpinLock cacheLock;         ///< Guards the cache.
+
         inline SortedView setupSortedView() const;
+
+        /// @brief Return the cached cumulative view, building it if the
+        ///        sketch changed since it was built.
+        inline const SortedView& sortedView() const;
     };
+
+    /// @brief mReqSketch with room for any sketch of M4 and Strawman,
+    ///        up to 32 compactors and 128 items.
+    using mReqSketch = mReqSketchN<32, 128>;
+
+    /// @brief mReqSketch sized exactly for a given sketch capacity and
+    ///        compactor capacity.
+    template <u32 SKETCH_CAP, u32 CMTOR_CAP>
+    using mReqSketchFor = mReqSketchN<
+        detail::mreq_cmtor_num(SKETCH_CAP, CMTOR_CAP),
+        detail::mreq_cmtor_num(SKETCH_CAP, CMTOR_CAP) * CMTOR_CAP>;
 } // namespace sketch
 
 #include "mreq_sketch_impl.hpp"
\ No newline at end of file
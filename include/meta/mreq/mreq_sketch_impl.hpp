@@ -2,69 +2,110 @@
 #include "mreq_sketch.hpp"
 #include <cmath>
 #include <cassert>
+#include <mutex>
 
 namespace sketch {
-    mReqSketch::mReqSketch(u32 sketch_cap_, u32 cmtor_cap_)
-        : itemNum(0), sketchCap(sketch_cap_) {
-        // to satisfy the requirement that
-        // cmtor_cap_ * (1 + 2 + ... + 2 ^ (cmtor_num - 1)) >= sketch_cap
-        u32 cmtor_num = std::ceil(
-            std::log2(static_cast<f64>(sketchCap) / cmtor_cap_ + 1));
-
-        cmtors.reserve(cmtor_num);
-        for (u32 i = 0; i < cmtor_num; ++i) {
-            cmtors.emplace_back(i, cmtor_cap_);
+    template <u32 MAX_CMTORS_, u32 MAX_ITEMS_>
+    mReqSketchN<MAX_CMTORS_, MAX_ITEMS_>::mReqSketchN(u32 sketch_cap_,
+                                                      u32 cmtor_cap_,
+                                                      u64 seed_) {
+        st.itemNum = 0;
+        st.sketchCap = sketch_cap_;
+        st.coin = rand_bit_generator(seed_);
+        st.cmtorNum = detail::mreq_cmtor_num(sketch_cap_, cmtor_cap_);
+
+        const u64 total = static_cast<u64>(st.cmtorNum) * cmtor_cap_;
+        if (st.cmtorNum > MAX_CMTORS || total > MAX_ITEMS) {
+            throw std::invalid_argument("mreq sketch too large");
         }
+
+        st.cmtors[0] = mReqCmtor(0, cmtor_cap_, 0);
+        for (u32 i = 1; i < st.cmtorNum; ++i) {
+            st.cmtors[i] = mReqCmtor(i, cmtor_cap_, total);
+        }
+    }
+
+    template <u32 MAX_CMTORS_, u32 MAX_ITEMS_>
+    mReqSketchN<MAX_CMTORS_, MAX_ITEMS_>::mReqSketchN(
+        const mReqSketchN& other) : st(other.st) { }
+
+    template <u32 MAX_CMTORS_, u32 MAX_ITEMS_>
+    auto mReqSketchN<MAX_CMTORS_, MAX_ITEMS_>::operator=(
+        const mReqSketchN& other) -> mReqSketchN& {
+        st = other.st;
+        view.reset();
+        hist.reset();
+        return *this;
     }
 
-    u32 mReqSketch::size() const {
-        return itemNum;
+    template <u32 MAX_CMTORS_, u32 MAX_ITEMS_>
+    u32 mReqSketchN<MAX_CMTORS_, MAX_ITEMS_>::size() const {
+        return st.itemNum;
     }
 
-    bool mReqSketch::empty() const {
+    template <u32 MAX_CMTORS_, u32 MAX_ITEMS_>
+    bool mReqSketchN<MAX_CMTORS_, MAX_ITEMS_>::empty() const {
         return size() == 0;
     }
 
-    bool mReqSketch::full() const {
-        return size() >= sketchCap;
+    template <u32 MAX_CMTORS_, u32 MAX_ITEMS_>
+    bool mReqSketchN<MAX_CMTORS_, MAX_ITEMS_>::full() const {
+        return size() >= st.sketchCap;
     }
 
-    u32 mReqSketch::memory() const {
-        return cmtors.capacity() * cmtors.front().memory();
+    template <u32 MAX_CMTORS_, u32 MAX_ITEMS_>
+    u32 mReqSketchN<MAX_CMTORS_, MAX_ITEMS_>::memory() const {
+        return st.cmtorNum * st.cmtors[0].memory();
     }
 
-    void mReqSketch::append(u32 item) {
+    template <u32 MAX_CMTORS_, u32 MAX_ITEMS_>
+    void mReqSketchN<MAX_CMTORS_, MAX_ITEMS_>::append(u32 item) {
         if (full()) {
             throw std::logic_error("append to a full mreq sketch");
         }
 
         // append to the first compactor
-        ++itemNum;
-        minItem = std::min(minItem, item);
-        maxItem = std::max(maxItem, item);
-        cmtors.front().append(item);
+        ++st.itemNum;
+        if (view || hist) {     // drop the outdated query cache
+            view.reset();
+            hist.reset();
+        }
+        st.minItem = std::min(st.minItem, item);
+        st.maxItem = std::max(st.maxItem, item);
+        mReqCmtor* cmtors = st.cmtors;
+        cmtors[0].append(st.items, item);
 
         // compact if needed
-        for (u32 i = 0; cmtors[i].full(); ++i) {
-            assert (i + 1 < cmtors.size());
-            cmtors[i].compact(cmtors[i + 1]);
+        u32 i = 0;
+        for (; cmtors[i].full(); ++i) {
+            assert (i + 1 < st.cmtorNum);
+            cmtors[i].compact(st.items, cmtors[i + 1], st.coin);
+        }
+
+        // keep emptied compactors right in front of the packed ones
+        for (u32 j = 1; j < i; ++j) {
+            cmtors[j].moveTo(cmtors[i].offset());
         }
     }
 
-    u32 mReqSketch::rank(u32 item, bool inclusive) const {
+    template <u32 MAX_CMTORS_, u32 MAX_ITEMS_>
+    u32 mReqSketchN<MAX_CMTORS_, MAX_ITEMS_>::rank(u32 item,
+                                                   bool inclusive) const {
         if (empty()) {
             throw std::runtime_error("rank on empty mreq sketch");
         }
 
         u32 rank = 0;
         // sum up ranks of all compactors
-        for (const auto& cmtor : cmtors) {
-            rank += cmtor.weightedRank(item, inclusive);
+        for (u32 i = 0; i < st.cmtorNum; ++i) {
+            rank += st.cmtors[i].weightedRank(st.items, item, inclusive);
         }
         return rank;
     }
 
-    f64 mReqSketch::nomRank(u32 item, bool inclusive) const {
+    template <u32 MAX_CMTORS_, u32 MAX_ITEMS_>
+    f64 mReqSketchN<MAX_CMTORS_, MAX_ITEMS_>::nomRank(u32 item,
+                                                      bool inclusive) const {
         if (empty()) {
             throw std::runtime_error("rank on empty mreq sketch");
         }
@@ -72,7 +113,9 @@ namespace sketch {
         return rk / size(); // normalize
     }
 
-    u32 mReqSketch::quantile(f64 nom_rank, bool inclusive) const {
+    template <u32 MAX_CMTORS_, u32 MAX_ITEMS_>
+    u32 mReqSketchN<MAX_CMTORS_, MAX_ITEMS_>::quantile(f64 nom_rank,
+                                                       bool inclusive) const {
         if (empty()) {
             throw std::runtime_error("get quantile on empty mreq sketch");
         }
@@ -81,30 +124,53 @@ namespace sketch {
             throw std::invalid_argument("normalized rank out of range");
         }
 
-        auto view = setupSortedView();
-        return view.quantile(nom_rank, inclusive);
+        return sortedView().quantile(nom_rank, inclusive);
     }
 
-    SortedView mReqSketch::setupSortedView() const {
+    template <u32 MAX_CMTORS_, u32 MAX_ITEMS_>
+    SortedView mReqSketchN<MAX_CMTORS_, MAX_ITEMS_>::setupSortedView() const {
         auto view = SortedView(size());
 
-        for (const auto& cmtor : cmtors) {
-            view.insert(cmtor.begin(), cmtor.end(), cmtor.weight());
+        for (u32 i = 0; i < st.cmtorNum; ++i) {
+            const auto& cmtor = st.cmtors[i];
+            view.insert(cmtor.begin(st.items), cmtor.end(st.items),
+                        cmtor.weight());
         }
-        view.insert(minItem, 0);
-        view.insert(maxItem, 0);
+        view.insert(st.minItem, 0);
+        view.insert(st.maxItem, 0);
 
         view.convertToCumulative();
 
         return view;
     }
 
-    mReqSketch::operator sketch::Histogram() const {
+    template <u32 MAX_CMTORS_, u32 MAX_ITEMS_>
+    const SortedView& mReqSketchN<MAX_CMTORS_, MAX_ITEMS_>::sortedView() const {
+        std::lock_guard<detail::SpinLock> guard(cacheLock);
+        if (!view) {
+            view = std::make_unique<SortedView>(setupSortedView());
+        }
+        return *view;
+    }
+
+    template <u32 MAX_CMTORS_, u32 MAX_ITEMS_>
+    mReqSketchN<MAX_CMTORS_, MAX_ITEMS_>::operator sketch::Histogram() const {
+        return histogram();
+    }
+
+    template <u32 MAX_CMTORS_, u32 MAX_ITEMS_>
+    const Histogram& mReqSketchN<MAX_CMTORS_, MAX_ITEMS_>::histogram() const {
         if (empty()) {
             throw std::runtime_error("convert an empty mreq sketch to histogram");
         }
 
-        auto view = setupSortedView();
-        return static_cast<sketch::Histogram>(view);
+        std::lock_guard<detail::SpinLock> guard(cacheLock);
+        if (!hist) {
+            // reuse the cached view if quantile() built one
+            hist = std::make_unique<Histogram>(view
+                ? static_cast<Histogram>(*view)
+                : static_cast<Histogram>(setupSortedView()));
+        }
+        return *hist;
     }
-}  // namespace sketch
\ No newline at end of file
+}  // namespace sketch
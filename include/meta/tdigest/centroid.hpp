@@ -5,7 +5,7 @@
 
 namespace sketch {
     class Centroid {
-        friend class TDigest;
+        template <u32> friend class TDigestN;
         friend class TDigestDiff;
     public:
         /// @brief Construct a centroid with mean 0.0 and weight 0.
@@ -14,7 +14,8 @@ namespace sketch {
         /// @brief Construct a centroid with given mean and weight.
         /// @param mean Mean of the centroid.
         /// @param weight Weight of the centroid.
-        Centroid(f64 mean, u32 weight) : m_mean(mean), m_weight(weight) {}
+        Centroid(f64 mean, u32 weight)
+            : m_mean(static_cast<f32>(mean)), m_weight(weight) {}
 
         /// @brief Return the mean of the centroid.
         f64 mean() const { return m_mean; }
@@ -24,9 +25,9 @@ namespace sketch {
         /// @brief Merge another centroid into this one.
         /// @param other The centroid to be merged.
         void merge(const Centroid& other) {
-            f64 sum = m_mean * m_weight + other.m_mean * other.m_weight;
+            f64 sum = mean() * m_weight + other.mean() * other.m_weight;
             m_weight += other.m_weight;
-            m_mean = sum / m_weight;
+            m_mean = static_cast<f32>(sum / m_weight);
         }
 
         /// @brief Append an item into the centroid.
@@ -52,9 +53,11 @@ namespace sketch {
         }
 
     private:
-        f64 m_mean;     ///< Mean of the centroid.
+        f32 m_mean;     ///< Mean of the centroid.
         u32 m_weight;   ///< Weight of the centroid.
     };
+
+    static_assert(sizeof(Centroid) == 8, "centroid should be packed");
 }   // namespace sketch
 
 #undef private
\ No newline at end of file
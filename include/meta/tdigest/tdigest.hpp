@@ -1,24 +1,45 @@
 #pragma once
 #include "centroid.hpp"
 #include <utility>
+#include <memory>
+#include <array>
 #include "../../common/histogram.hpp"
+#include "../../common/parallel.hpp"
 
 namespace sketch {
-    class TDigest {
+    /// @brief t-digest with room for arguments delta up to MAX_DELTA_,
+    ///        see TDigest.
+    template <u32 MAX_DELTA_>
+    class TDigestN {
+        static_assert(MAX_DELTA_ >= 1 && MAX_DELTA_ <= UINT8_MAX,
+                      "delta and centroid counts are u8");
+
     public:
         /// @brief Default constructor.
         /// @warning Members are potential uninitialized after construction.
         ///          Make sure you know what you are doing.
-        TDigest() = default;
+        TDigestN() = default;
 
         /// @brief Constructor.
         /// @param cap_ Capacity, i.e. maximum number of items that
         ///             can be held in the t-digest.
         /// @param delta_ Argument for compression.
-        TDigest(u32 cap_, u32 delta_);
+        /// @throw std::invalid_argument If delta_ is 0 or above MAX_DELTA.
+        TDigestN(u32 cap_, u32 delta_);
+
+        /// @brief Copy constructor, which copies the centroids but not
+        ///        the query cache.
+        TDigestN(const TDigestN& other);
+        /// @brief Copy assignment, which copies the centroids but not
+        ///        the query cache.
+        TDigestN& operator=(const TDigestN& other);
+        /// @brief Move constructor.
+        TDigestN(TDigestN&& other) = default;
+        /// @brief Move assignment.
+        TDigestN& operator=(TDigestN&& other) = default;
 
         /// @brief Destructor.
-        ~TDigest() = default;
+        ~TDigestN() = default;
 
         /// @brief Return the number of items in the t-digest.
         inline u32 size() const;
@@ -26,7 +47,9 @@ namespace sketch {
         /// @brief Return whether the t-digest is empty.
         inline bool empty() const;
 
-        /// @brief Return whether the t-digest is full.
+        /// @brief Return whether the t-digest is full, i.e. whether its
+        ///        heaviest centroid could reach the capacity once the
+        ///        buffered items are merged.
         inline bool full() const;
 
         /// @brief Return the number of bytes the t-digest uses.
@@ -34,53 +57,84 @@ namespace sketch {
 
         /// @brief Append an item to the t-digest.
         /// @param item The item to append.
+        /// @note Items are buffered and merged into the centroids in one
+        ///       pass once @c DELTA of them are buffered, or once they
+        ///       could make the t-digest full.
         inline void append(u32 item);
 
         /// @brief Estimate the quantile value of a normalized rank.
         /// @param nom_rank Normalized rank.
+        /// @note Queries are thread-safe as long as no item is appended.
         inline u32 quantile(f64 nom_rank) const;
 
         /// @brief Convert the t-digest to a histogram.
         inline operator Histogram() const;
+
+        /// @brief Return the cached histogram, rebuilding it if the
+        ///        t-digest changed since it was built.
+        /// @note The reference stays valid until the next append.
+        inline const Histogram& histogram() const;
+
+        /// Maximum argument delta.
+        static constexpr u32 MAX_DELTA = MAX_DELTA_;
         
     private:
-        vector<Centroid> centroids; ///< Centroids in the t-digest.
+        /// Merged centroids sorted by mean, inline, so a t-digest makes
+        /// no allocation until it is queried.
+        std::array<Centroid, MAX_DELTA> centroids;
+        /// Items appended since the last merge, in append order.
+        std::array<u32, MAX_DELTA> buffer;
+        /// Query cache, allocated on the first query and rebuilt on
+        /// demand after an append, so unqueried t-digests stay small.
+        mutable std::unique_ptr<Histogram> hist;
         u32 totalWeight;            ///< Total weight.
         u32 cap;                    ///< Capacity.
-        u32 DELTA;                  ///< Argument delta, logically const.
-
         u32 min_item = UINT32_MAX;  ///< Minimum item value.
         u32 max_item = 0;           ///< Maximum item value.
-        u32 max_weight = 0;
-
-        /// @brief Calculate scale function of a percentage.
-        /// @param p Percentage.
-        inline f64 scale(f64 p) const;
-
-        /// @brief Calculate the quantile bounds of a centroid.
-        /// @param c The centroid, must be an element in @c centroids.
-        /// @return A @c std::pair<f64, f64>, whose first key is the
-        ///         centroid's q_{left} and second key is its q_{right}.
-        inline std::pair<f64, f64> qBound(const Centroid& c) const;
-
-        /// @brief Calculate the k-size of a centroid.
-        /// @param c The centroid, must be an element, in @c centroids.
-        inline f64 kSize(const Centroid& c) const;
-    
-        inline void compressNearest();
-
-        /// @brief Find the appending position of a new item.
-        /// @param item The item to append.
-        /// @return Pointer to a centroid if found appropriate position,
-        ///         @c nullptr otherwise.
-        inline Centroid* findAppendPos(u32 item);
-
-        /// @brief Check whether a centroid can be appended to, i.e.
-        ///        its k-size still no more than 1 after the appending.
-        /// @param c The centroid to be appended to, 
-        ///          must be an element in @c centroids.
-        inline bool appendable(const Centroid& c) const;
+        u32 max_weight = 0;         ///< Maximum weight of merged centroids.
+        u8 DELTA;                   ///< Argument delta, logically const.
+        u8 mergedNum = 0;           ///< Number of merged centroids.
+        u8 bufferedNum = 0;         ///< Number of buffered items.
+        mutable bool histDirty = true;      ///< If @c hist is outdated.
+        mutable detail::SpinLock cacheLock; ///< Guards @c hist.
+
+        /// @brief Cosine and sine of 2 * PI / delta, the angle in
+        ///        asin(2q - 1) that a centroid of k-size 1 spans.
+        struct KStep {
+            f64 cos;
+            f64 sin;
+        };
+
+        /// @brief Return the k-step of a given delta from a table shared
+        ///        by all t-digests.
+        static inline const KStep& kStep(u32 delta);
+
+        /// @brief Calculate the largest right quantile bound a centroid
+        ///        can reach with k-size no more than 1.
+        /// @param q_left Left quantile bound of the centroid.
+        inline f64 qLimit(f64 q_left) const;
+
+        /// @brief Merge buffered items into the centroids in one pass.
+        inline void flush();
+
+        /// @brief Merge buffered items into centroids res[0, merged)
+        ///        sorted by mean, in one pass.
+        /// @param res Centroids, with room for DELTA of them.
+        /// @param items Buffered items, sorted on return.
+        /// @param max_w Maximum weight, raised to that of new centroids.
+        /// @return Number of centroids after merging.
+        inline u32 merge(Centroid* res, u32 merged, u32* items,
+                         u32 buffered, u32& max_w) const;
+
+        /// @brief Merge the adjacent pair of centroids in c[0, n) with
+        ///        the smallest k-size among those whose weights sum to
+        ///        no more than the capacity, or the lightest pair if
+        ///        there is none.
+        inline void compressNearest(Centroid* c, u32 n, u32& max_w) const;
     };
+
+    /// @brief t-digest with room for any delta up to 64.
+    using TDigest = TDigestN<64>;
 }   // namespace sketch
 
 #include "tdigest_impl.hpp"
\ No newline at end of file
@@ -5,178 +5,309 @@
 #include <algorithm>
 #include <iomanip>
 #include <cassert>
+#include <array>
+#include <mutex>
 #include "../../common/vec_ops.hpp"
 
 namespace sketch{
-    TDigest::TDigest(u32 cap_, u32 delta_)
-        : totalWeight(0), cap(cap_), DELTA(delta_) {}
+    template <u32 MAX_DELTA_>
+    TDigestN<MAX_DELTA_>::TDigestN(u32 cap_, u32 delta_)
+        : totalWeight(0), cap(cap_), DELTA(delta_) {
+        if (delta_ == 0 || delta_ > MAX_DELTA) {
+            throw std::invalid_argument("t-digest delta out of range");
+        }
+    }
+
+    template <u32 MAX_DELTA_>
+    TDigestN<MAX_DELTA_>::TDigestN(const TDigestN& other)
+        : totalWeight(other.totalWeight), cap(other.cap),
+          min_item(other.min_item), max_item(other.max_item),
+          max_weight(other.max_weight), DELTA(other.DELTA),
+          mergedNum(other.mergedNum), bufferedNum(other.bufferedNum) {
+        std::copy_n(other.centroids.begin(), mergedNum, centroids.begin());
+        std::copy_n(other.buffer.begin(), bufferedNum, buffer.begin());
+    }
+
+    template <u32 MAX_DELTA_>
+    auto TDigestN<MAX_DELTA_>::operator=(const TDigestN& other)
+        -> TDigestN& {
+        if (this != &other) {
+            *this = TDigestN(other);
+        }
+        return *this;
+    }
 
-    u32 TDigest::size() const {
+    template <u32 MAX_DELTA_>
+    u32 TDigestN<MAX_DELTA_>::size() const {
         return totalWeight;
     }
 
-    bool TDigest::empty() const {
+    template <u32 MAX_DELTA_>
+    bool TDigestN<MAX_DELTA_>::empty() const {
         return size() == 0;
     }
 
-    bool TDigest::full() const {
-        return max_weight >= cap;
+    template <u32 MAX_DELTA_>
+    bool TDigestN<MAX_DELTA_>::full() const {
+        return static_cast<u64>(max_weight) + bufferedNum >= cap;
     }
 
-    u32 TDigest::memory() const {
+    template <u32 MAX_DELTA_>
+    u32 TDigestN<MAX_DELTA_>::memory() const {
         const u32 counter_bits = std::ceil(std::log2(static_cast<f64>(cap) + 1));
         const u32 centroid_bits = counter_bits + 32;
         return (centroid_bits * DELTA + 7) / 8;
     }
 
-    f64 TDigest::scale(f64 p) const {
-        const f64 PI = acos(-1);
-        return asin(2 * p - 1) / (2 * PI) * DELTA;
-    }
-
-    std::pair<f64, f64> TDigest::qBound(const Centroid& c) const {
-        f64 q_left = 0.0, q_right = 0.0;
-        for (const auto& centroid : centroids) {
-            if (Centroid::addr_equal(centroid, c)) {
-                q_right = q_left + centroid.weight();
-                break;
+    template <u32 MAX_DELTA_>
+    auto TDigestN<MAX_DELTA_>::kStep(u32 delta) -> const KStep& {
+        static const auto table = [] {
+            std::array<KStep, MAX_DELTA + 1> t{};
+            const f64 PI = acos(-1);
+            for (u32 d = 1; d <= MAX_DELTA; ++d) {
+                // Spans over PI cover the whole quantile range anyway.
+                f64 angle = std::min(2 * PI / d, PI);
+                t[d] = {cos(angle), sin(angle)};
             }
-            q_left += centroid.weight();
-        }
-        if (q_right == 0.0) {
-            throw std::invalid_argument("centroid not found");
-        }
-        q_left /= totalWeight;
-        q_right /= totalWeight;
-        return {q_left, q_right};
+            return t;
+        }();
+        return table[delta];
     }
 
-    f64 TDigest::kSize(const Centroid& c) const {
-        auto [q_left, q_right] = qBound(c);
-        return scale(q_right) - scale(q_left);
+    template <u32 MAX_DELTA_>
+    f64 TDigestN<MAX_DELTA_>::qLimit(f64 q_left) const {
+        // With scale k(q) = asin(2q - 1) / (2 * PI) * DELTA, k-size 1
+        // spans an angle of 2 * PI / DELTA in asin(2q - 1), so the bound
+        // follows from the sine addition formula.
+        const KStep& step = kStep(DELTA);
+        f64 a = 2 * q_left - 1;
+        if (a >= step.cos) {
+            return 1.0;
+        }
+        f64 b = a * step.cos + std::sqrt(1 - a * a) * step.sin;
+        return (b + 1) / 2;
     }
 
-    void TDigest::append(u32 item) {
+    template <u32 MAX_DELTA_>
+    void TDigestN<MAX_DELTA_>::append(u32 item) {
         if (full()) {
             throw std::logic_error("append to a full t-digest");
         }
 
-        if (centroids.size() < DELTA) {
-            vec_insert_ordered(centroids, Centroid(item, 1),
-                               Centroid::mean_less);
-            ++totalWeight;
-            min_item = std::min(min_item, item);
-            max_item = std::max(max_item, item);
-            return;
-        }
-
-        Centroid* pos = findAppendPos(item);
-        if (pos == nullptr) {
-            vec_insert_ordered(centroids, Centroid(item, 1),
-                               Centroid::mean_less);
-            max_weight = std::max(max_weight, 1u);
-        } else {
-            pos->append(item);
-            max_weight = std::max(max_weight, pos->weight());
-        }
-
+        buffer[bufferedNum++] = item;
         ++totalWeight;
+        histDirty = true;
         min_item = std::min(min_item, item);
         max_item = std::max(max_item, item);
 
-        std::sort(centroids.begin(), centroids.end(), Centroid::mean_less);
-        if (centroids.size() > DELTA) {
-            compressNearest();
+        // Flushing before the buffered items could reach the capacity
+        // leaves full() true only if a merged centroid reached it.
+        if (bufferedNum >= DELTA
+            || static_cast<u64>(max_weight) + bufferedNum >= cap) {
+            flush();
+        }
+    }
+
+    template <u32 MAX_DELTA_>
+    void TDigestN<MAX_DELTA_>::flush() {
+        if (bufferedNum == 0) {
+            return;
         }
+        mergedNum = merge(centroids.data(), mergedNum, buffer.data(),
+                          bufferedNum, max_weight);
+        bufferedNum = 0;
     }
 
-    Centroid* TDigest::findAppendPos(u32 item) {
-        Centroid* pos = nullptr;
-        f64 min_dist = UINT32_MAX;
-        u32 max_weight = 0;
+    template <u32 MAX_DELTA_>
+    u32 TDigestN<MAX_DELTA_>::merge(Centroid* res, u32 merged, u32* items,
+                                    u32 buffered, u32& max_w) const {
+        // Fixed scratch on the stack: items as centroids of weight 1
+        // behind a copy of the merged ones, and the merge output, which
+        // holds up to 2 * DELTA centroids before compression.
+        Centroid c[2 * MAX_DELTA], out[2 * MAX_DELTA];
+        const u32 m = merged, n = merged + buffered;
+        u32 len = 0;
+        std::sort(items, items + buffered);
+        std::copy_n(res, m, c);
+        for (u32 k = 0; k < buffered; ++k) {
+            c[m + k] = Centroid(items[k], 1);
+        }
 
-        const f64 eps = 1e-5;
-        for (auto& centroid : centroids) {
-            f64 dist = std::fabs(centroid.mean() - item);
-            if (dist > min_dist + eps) {
-                continue;
-            }
-            if (dist < min_dist - eps) {
-                min_dist = dist;
-                pos = nullptr;
-                max_weight = 0;
+        if (n <= DELTA) {
+            len = std::merge(c, c + m, c + m, c + n, out, Centroid::mean_less)
+                - out;
+        } else {
+            // Walk merged centroids and sorted buffered items together.
+            // Each item goes into its nearest neighbour if the neighbour's
+            // k-size stays no more than 1, which is checked against the
+            // cumulative weight left of the neighbour, or becomes a new
+            // centroid.
+            f64 w_left = 0.0;   // Weight left of out[len - 1].
+            auto fits = [this](f64 w_before, u32 weight) {
+                return w_before + weight + 1
+                    <= qLimit(w_before / totalWeight) * totalWeight;
+            };
+            auto emit = [&](const Centroid& x) {
+                w_left += len == 0 ? 0 : out[len - 1].weight();
+                out[len++] = x;
+            };
+
+            u32 i = 0, j = m;
+            while (j < n) {
+                if (i < m && c[i].mean() <= c[j].mean()) {
+                    emit(c[i++]);
+                    continue;
+                }
+                f64 dist_left = len == 0 ? INFINITY
+                              : c[j].mean() - out[len - 1].mean();
+                f64 dist_right = i < m ? c[i].mean() - c[j].mean()
+                               : INFINITY;
+                if (dist_right < dist_left) {
+                    f64 w_before = w_left + (len == 0 ? 0
+                                             : out[len - 1].weight());
+                    if (fits(w_before, c[i].weight())) {
+                        emit(c[i++]);
+                        out[len - 1].merge(c[j++]);
+                        continue;
+                    }
+                } else if (len > 0 && fits(w_left, out[len - 1].weight())) {
+                    out[len - 1].merge(c[j++]);
+                    continue;
+                }
+                emit(c[j++]);
+                // A centroid that took an item from its left may have
+                // moved past the new one, which then goes before it, as
+                // a sorted insertion would place it.
+                u32 k = len - 1;
+                if (k > 0 && out[k].mean() < out[k - 1].mean()) {
+                    w_left += static_cast<f64>(out[k].weight())
+                            - out[k - 1].weight();
+                }
+                for (; k > 0 && out[k].mean() < out[k - 1].mean(); --k) {
+                    std::swap(out[k], out[k - 1]);
+                }
             }
-            if (appendable(centroid) && centroid.weight() > max_weight) {
-                pos = &centroid;
-                max_weight = centroid.weight();
+            while (i < m) {
+                out[len++] = c[i++];
             }
         }
 
-        return pos;
-    }
-
-    bool TDigest::appendable(const Centroid& c) const {
-        Centroid& c_ref = const_cast<Centroid&>(c);
-        c_ref.m_weight += 1;
-        f64 size = kSize(c_ref);
-        c_ref.m_weight -= 1;
-        return size <= 1;
+        for (u32 i = 0; i < len; ++i) {
+            max_w = std::max(max_w, out[i].weight());
+        }
+        for (; len > DELTA; --len) {
+            compressNearest(out, len, max_w);
+        }
+        std::copy_n(out, len, res);
+        return len;
     }
 
-    void TDigest::compressNearest() {
-        if (centroids.size() <= 1) {
+    template <u32 MAX_DELTA_>
+    void TDigestN<MAX_DELTA_>::compressNearest(Centroid* c, u32 n,
+                                               u32& max_w) const {
+        if (n <= 1) {
             return;
         }
 
-        f64 min_size = UINT32_MAX;
-        auto pos = centroids.begin();
-        auto i = pos, j = pos + 1;
-        f64 q_left = 0.0, q_right = i->weight();
+        // The pair with the smallest k-size spans the smallest angle
+        // asin(b) - asin(a) between its quantile bounds mapped to
+        // [-1, 1], i.e. the largest cosine of that angle. Pairs heavier
+        // than the capacity are skipped, so merging never makes a
+        // centroid outgrow its counter unless every pair would.
+        auto root = [](f64 x) {
+            return std::sqrt(std::max(0.0, 1 - x * x));
+        };
+        const f64 total = totalWeight;
+        f64 max_cos = -2.0;
+        u64 min_pair = UINT64_MAX;
+        Centroid* const begin = c;
+        Centroid* const end = begin + n;
+        Centroid* pos = nullptr, * lightest = begin;
+        Centroid* i = begin, * j = begin + 1;
+        f64 w_right = i->weight();
+        f64 a = -1.0, root_a = 0.0;
+        f64 b = 2 * w_right / total - 1, root_b = root(b);
 
-        while (j != centroids.end()) {
-            q_right += j->weight();
-            f64 size = scale(q_right / totalWeight)
-                     - scale(q_left / totalWeight);
-            if (size < min_size) {
-                min_size = size;
+        while (j != end) {
+            w_right += j->weight();
+            f64 d = 2 * w_right / total - 1, root_d = root(d);
+            f64 cos_span = root_a * root_d + a * d;
+            u64 pair = static_cast<u64>(i->weight()) + j->weight();
+            if (pair <= cap && cos_span > max_cos) {
+                max_cos = cos_span;
                 pos = i;
             }
-            q_left += i->weight();
+            if (pair < min_pair) {
+                min_pair = pair;
+                lightest = i;
+            }
+            a = b, root_a = root_b;
+            b = d, root_b = root_d;
             ++i, ++j;
         }
+        if (pos == nullptr) {
+            pos = lightest;
+        }
 
-        assert(min_size <= 1);
         pos->merge(*(pos + 1));
-        centroids.erase(pos + 1);
-        max_weight = std::max(max_weight, pos->weight());
+        std::copy(pos + 2, end, pos + 1);
+        max_w = std::max(max_w, pos->weight());
     }
 
-    u32 TDigest::quantile(f64 nom_rank) const {
+    template <u32 MAX_DELTA_>
+    u32 TDigestN<MAX_DELTA_>::quantile(f64 nom_rank) const {
         if (empty()) {
             throw std::logic_error("get quantile on empty t-digest");
         }
-        return static_cast<Histogram>(*this).quantile(nom_rank);
+        return histogram().quantile(nom_rank);
+    }
+
+    template <u32 MAX_DELTA_>
+    TDigestN<MAX_DELTA_>::operator Histogram() const {
+        return histogram();
     }
 
-    TDigest::operator Histogram() const {
-        const auto& c = centroids;
-        assert(c.size() > 0);
-        vec_f64 split(c.size() + 2, 0);
-        vec_u32 height(c.size() + 1, 0);
-        
-        split.front() = min_item - f64_equal(min_item, c.front().mean());
-        for (u32 i = 0; i < c.size(); ++i) {
-            split[i + 1] = c[i].mean();
+    template <u32 MAX_DELTA_>
+    const Histogram& TDigestN<MAX_DELTA_>::histogram() const {
+        std::lock_guard<detail::SpinLock> guard(cacheLock);
+        if (!histDirty) {
+            return *hist;
+        }
+        if (!hist) {
+            hist.reset(new Histogram());
+        }
+
+        // Merge a copy, so queries leave the t-digest itself untouched.
+        Centroid c[MAX_DELTA];
+        u32 items[MAX_DELTA];
+        std::copy_n(centroids.begin(), mergedNum, c);
+        std::copy_n(buffer.begin(), bufferedNum, items);
+        u32 max_w = max_weight;
+        const u32 n = merge(c, mergedNum, items, bufferedNum, max_w);
+        assert(n > 0);
+        vec_f64 split(n + 2, 0);
+        vec_u32 height(n + 1, 0);
+
+        // Means are f32, which rounds values above 2^24, so an outer
+        // mean may fall out of [min_item, max_item]. Clamping the means
+        // into it and keeping them in order keeps split points sorted.
+        f64 mean = min_item;
+        for (u32 i = 0; i < n; ++i) {
+            mean = std::min<f64>(std::max(mean, c[i].mean()), max_item);
+            split[i + 1] = mean;
         }
-        split.back() = max_item + f64_equal(max_item, c.back().mean());
+        split.front() = min_item - f64_equal(min_item, split[1]);
+        split.back() = max_item + f64_equal(max_item, split[n]);
 
-        height.front() = c.front().weight() / 2;
-        for (u32 i = 0; i < c.size(); ++i) {
+        height.front() = c[0].weight() / 2;
+        for (u32 i = 0; i + 1 < n; ++i) {
             height[i + 1] += (c[i].weight() + 1) / 2;
             height[i + 1] += c[i + 1].weight() / 2;
         }
-        height.back() = (c.back().weight() + 1) / 2;
+        height.back() = (c[n - 1].weight() + 1) / 2;
 
-        return Histogram(split, height);
+        *hist = Histogram(split, height);
+        histDirty = false;
+        return *hist;
     }
 }   // namespace sketch
@@ -0,0 +1,95 @@
+#pragma once
+#include "sketch_test.hpp"
+#include <functional>
+#include <ostream>
+
+namespace sketch {
+    /// @brief Metrics of one configuration of a sweep, plain data so
+    ///        that the process running it can send them through a pipe.
+    struct SweepMetrics {
+        f64 ALE[NUM_MODELS];
+        f64 APE[NUM_MODELS];
+        f64 appendTp[NUM_MODELS];   ///< Appending throughput in Mops.
+        f64 queryTp[NUM_MODELS];    ///< Query throughput in Mops.
+        u64 rss[NUM_MODELS];        ///< Resident bytes of each model.
+        char error[256];            ///< Why it failed, empty if it did not.
+    };
+
+    /// @brief Sweep of tests over METAs, memory limits and hash numbers
+    ///        on one dataset.
+    /// @details The dataset is loaded and its ground truth built once.
+    ///          Each configuration then runs in a process of its own,
+    ///          forked from the sweep, which shares both copy-on-write
+    ///          and starts from a trimmed heap, so that the memory its
+    ///          models take can be read from its resident set. Up to
+    ///          @c jobs configurations run at once, each pinned to its
+    ///          own share of cores.
+    class SketchSweep {
+    public:
+        /// @brief Result of one configuration.
+        struct Result {
+            string meta;
+            u64 mem_limit;      ///< Memory limit in bytes.
+            u32 hash_num;
+            SweepMetrics metrics;
+        };
+
+        /// @brief Constructor.
+        /// @param dataset_ Dataset to be tested, which is loaded.
+        /// @param repeat_ Number of repetitions per configuration.
+        /// @param seed_ Seed of every configuration.
+        /// @param jobs_ Number of configurations run at once, 0 for one
+        ///              per core. Concurrent ones share memory bandwidth,
+        ///              so their timings are only comparable among runs
+        ///              with the same number of jobs.
+        SketchSweep(const string& dataset_, u32 repeat_, u32 seed_,
+                    u32 jobs_ = 1);
+
+        /// @brief Add the configurations of a META, one per memory limit
+        ///        and hash number.
+        /// @param meta Name of the META in the results.
+        /// @param mem_limits Memory limits in bytes.
+        template <typename META>
+        inline void add(const string& meta, const vector<u64>& mem_limits,
+                        const vector<u32>& hash_nums);
+
+        /// @brief Run all configurations added.
+        /// @throw std::runtime_error If any configuration failed, after
+        ///        all of them ran.
+        inline void run();
+
+        /// @brief Return the results in the order configurations were
+        ///        added.
+        inline const vector<Result>& results() const;
+
+        /// @brief Write the results as CSV, one row per model.
+        inline void writeCSV(std::ostream& out) const;
+
+        /// @brief Write the results as a JSON array, one object per
+        ///        model.
+        inline void writeJSON(std::ostream& out) const;
+
+    private:
+        /// @brief Run one configuration on the shared dataset.
+        using Runner = std::function<void(const vector<FlowItem>&,
+                                          const real_dist&,
+                                          SweepMetrics&)>;
+
+        string dataset;     ///< Dataset to be tested.
+        u32 repeat;         ///< Number of repetitions per configuration.
+        u32 seed;           ///< Seed of every configuration.
+        u32 jobs;           ///< Number of configurations run at once.
+
+        vector<Result> res;         ///< Results, in order of adding.
+        vector<Runner> runners;     ///< Runner of each result.
+
+        /// @brief Run one configuration of a given META.
+        template <typename META>
+        inline void runConfig(u64 mem_limit, u32 hash_num,
+                              const vector<FlowItem>& dataset_loaded,
+                              const real_dist& real,
+                              SweepMetrics& metrics) const;
+    };
+}   // namespace sketch
+
+#include "sketch_sweep_impl.hpp"
@@ -0,0 +1,233 @@
+#pragma once
+#include "sketch_sweep.hpp"
+#include "../common/parallel.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <malloc.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace sketch {
+namespace detail {
+    /// @brief Return the resident set size of the process in bytes, 0 if
+    ///        it cannot be read.
+    inline u64 resident_bytes() {
+        std::ifstream statm("/proc/self/statm");
+        u64 size, resident;
+        if (!(statm >> size >> resident)) {
+            return 0;
+        }
+        return resident * sysconf(_SC_PAGESIZE);
+    }
+
+    /// @brief Name of a model in sweep results.
+    inline const char* sweep_model_name(u32 model) {
+        return model == M4MODEL ? "m4" : "strawman";
+    }
+}   // namespace detail
+
+    SketchSweep::SketchSweep(const string& dataset_, u32 repeat_, u32 seed_,
+                             u32 jobs_)
+        : dataset(dataset_), repeat(repeat_), seed(seed_), jobs(jobs_) { }
+
+    template <typename META>
+    void SketchSweep::add(const string& meta, const vector<u64>& mem_limits,
+                          const vector<u32>& hash_nums) {
+        for (u64 mem_limit : mem_limits) {
+            for (u32 hash_num : hash_nums) {
+                res.push_back({meta, mem_limit, hash_num, {}});
+                runners.push_back([=](const vector<FlowItem>& dataset_loaded,
+                                      const real_dist& real,
+                                      SweepMetrics& metrics) {
+                    runConfig<META>(mem_limit, hash_num, dataset_loaded,
+                                    real, metrics);
+                });
+            }
+        }
+    }
+
+    template <typename META>
+    void SketchSweep::runConfig(u64 mem_limit, u32 hash_num,
+                                const vector<FlowItem>& dataset_loaded,
+                                const real_dist& real,
+                                SweepMetrics& metrics) const {
+        // Fill each model once more, untimed, to read the memory it
+        // takes before any query builds a cache. Freed memory is given
+        // back first, so that the models do not reuse pages the sweep
+        // left resident.
+        malloc_trim(0);
+        const u64 base = detail::resident_bytes();
+        {
+            M4<META> m4(mem_limit, hash_num, seed);
+            for (const FlowItem& item : dataset_loaded) {
+                m4.append(item.id, item.value);
+            }
+            const u64 with_m4 = detail::resident_bytes();
+            Strawman<META> straw(mem_limit, seed);
+            for (const FlowItem& item : dataset_loaded) {
+                straw.append(item.id, item.value);
+            }
+            const u64 with_both = detail::resident_bytes();
+            metrics.rss[M4MODEL] = with_m4 - std::min(base, with_m4);
+            metrics.rss[STRAW] = with_both - std::min(with_m4, with_both);
+        }
+
+        // repetitions one after another on the cores of this process
+        SketchTest<META> test(mem_limit, hash_num, seed, dataset, repeat,
+                              false, 1);
+        test.run(dataset_loaded, real);
+        for (u32 i = 0; i < NUM_MODELS; ++i) {
+            metrics.ALE[i] = test.ALE(i);
+            metrics.APE[i] = test.APE(i);
+            metrics.appendTp[i] = test.appendTp(i);
+            metrics.queryTp[i] = test.queryTp(i);
+        }
+    }
+
+    void SketchSweep::run() {
+        vector<FlowItem> dataset_loaded;
+        real_dist real;
+        prepare_dataset(dataset, false, dataset_loaded, real);
+
+        // No other thread runs here, so forking is safe. A slot is a
+        // share of cores, running one configuration at a time.
+        const u32 slot_num = detail::worker_count(res.size(), jobs);
+        const u32 core_num = detail::core_count();
+        const u32 share = std::max(1u, core_num / slot_num);
+        vector<pid_t> pids(slot_num, 0);
+        vector<int> pipes(slot_num, -1);
+        vector<u64> configs(slot_num, 0);
+
+        auto describe = [&](u64 c) {
+            return res[c].meta + " at " + std::to_string(res[c].mem_limit
+                   / 1024) + " KB with " + std::to_string(res[c].hash_num)
+                   + " hashes";
+        };
+        // wait for a configuration to end and return its slot
+        auto collect = [&]() -> u32 {
+            int status = 0;
+            pid_t pid;
+            while ((pid = waitpid(-1, &status, 0)) < 0 && errno == EINTR);
+            if (pid < 0) {
+                throw std::runtime_error("sweep lost its configurations");
+            }
+            u32 slot = std::find(pids.begin(), pids.end(), pid)
+                     - pids.begin();
+            SweepMetrics& metrics = res[configs[slot]].metrics;
+            char* dst = reinterpret_cast<char*>(&metrics);
+            u64 got = 0;
+            ssize_t n;
+            while (got < sizeof(metrics)
+                   && ((n = read(pipes[slot], dst + got,
+                                 sizeof(metrics) - got)) > 0
+                       || (n < 0 && errno == EINTR))) {
+                got += std::max<ssize_t>(n, 0);
+            }
+            close(pipes[slot]);
+            if (got != sizeof(metrics) || !WIFEXITED(status)
+                || WEXITSTATUS(status) != 0) {
+                std::strcpy(metrics.error, "exited abnormally");
+            }
+            pids[slot] = 0;
+            return slot;
+        };
+
+        for (u64 c = 0; c < res.size(); ++c) {
+            auto free_slot = std::find(pids.begin(), pids.end(), 0);
+            const u32 slot = free_slot != pids.end()
+                           ? free_slot - pids.begin() : collect();
+            int fds[2];
+            if (pipe(fds) != 0) {
+                throw std::runtime_error("cannot create a pipe for "
+                                         + describe(c));
+            }
+            cout << "Running " << describe(c) << "..." << endl;
+            cout.flush();
+            const pid_t pid = fork();
+            if (pid < 0) {
+                throw std::runtime_error("cannot fork for " + describe(c));
+            }
+            if (pid == 0) {
+                close(fds[0]);
+                if (slot_num > 1
+                    && !detail::pin_thread(slot * share % core_num, share)) {
+                    cerr << "warning: cannot pin " << describe(c)
+                         << ", its timings may share cores" << endl;
+                }
+                SweepMetrics metrics = {};
+                try {
+                    runners[c](dataset_loaded, real, metrics);
+                } catch (const std::exception& e) {
+                    std::strncpy(metrics.error, e.what(),
+                                 sizeof(metrics.error) - 1);
+                }
+                cout.flush();
+                const bool sent = write(fds[1], &metrics, sizeof(metrics))
+                                  == sizeof(metrics);
+                _exit(sent ? 0 : 1);
+            }
+            close(fds[1]);
+            pids[slot] = pid;
+            pipes[slot] = fds[0];
+            configs[slot] = c;
+        }
+        while (std::find_if(pids.begin(), pids.end(), [](pid_t pid) {
+                   return pid != 0;
+               }) != pids.end()) {
+            collect();
+        }
+
+        string failed;
+        for (u64 c = 0; c < res.size(); ++c) {
+            if (res[c].metrics.error[0] != '\0') {
+                failed += "\n    " + describe(c) + ": "
+                        + res[c].metrics.error;
+            }
+        }
+        if (!failed.empty()) {
+            throw std::runtime_error("sweep configurations failed:" + failed);
+        }
+    }
+
+    const vector<SketchSweep::Result>& SketchSweep::results() const {
+        return res;
+    }
+
+    void SketchSweep::writeCSV(std::ostream& out) const {
+        out << "meta,memory_kb,hash_num,model,ALE,APE,append_mops,"
+            << "query_mops,rss_kb" << endl;
+        for (const Result& r : res) {
+            const SweepMetrics& m = r.metrics;
+            for (u32 i = 0; i < NUM_MODELS; ++i) {
+                out << r.meta << ',' << r.mem_limit / 1024 << ','
+                    << r.hash_num << ',' << detail::sweep_model_name(i)
+                    << ',' << m.ALE[i] << ',' << m.APE[i] << ','
+                    << m.appendTp[i] << ',' << m.queryTp[i] << ','
+                    << m.rss[i] / 1024 << endl;
+            }
+        }
+    }
+
+    void SketchSweep::writeJSON(std::ostream& out) const {
+        out << '[';
+        bool first = true;
+        for (const Result& r : res) {
+            const SweepMetrics& m = r.metrics;
+            for (u32 i = 0; i < NUM_MODELS; ++i) {
+                out << (first ? "\n" : ",\n") << "  {\"meta\": \""
+                    << r.meta << "\", \"memory_kb\": " << r.mem_limit / 1024
+                    << ", \"hash_num\": " << r.hash_num
+                    << ", \"model\": \"" << detail::sweep_model_name(i)
+                    << "\", \"ALE\": " << m.ALE[i]
+                    << ", \"APE\": " << m.APE[i]
+                    << ", \"append_mops\": " << m.appendTp[i]
+                    << ", \"query_mops\": " << m.queryTp[i]
+                    << ", \"rss_kb\": " << m.rss[i] / 1024 << '}';
+                first = false;
+            }
+        }
+        out << "\n]" << endl;
+    }
+}   // namespace sketch
@@ -1,10 +1,23 @@
 #pragma once
-#include <unordered_set>
 #include "../framework/m4/m4.hpp"
 #include "../framework/strawman/strawman.hpp"
 #include "../common/real_dist.hpp"
+#include "../common/dataset.hpp"
+#include "../common/latency.hpp"
+#include "../common/perf_counters.hpp"
+#include <mutex>
 
 namespace sketch {
+    /// @brief Load a dataset, unless it is streamed, and build its ground
+    ///        truth, to be shared by tests.
+    /// @param dataset_loaded Set to the loaded dataset, left empty if
+    ///        streaming, in which case the ground truth takes a pass of
+    ///        its own.
+    /// @param real Empty ground truth to build.
+    inline void prepare_dataset(const string& dataset, bool streaming,
+                                vector<FlowItem>& dataset_loaded,
+                                real_dist& real);
+
     template <typename META>
     class SketchSingleTest {
     public:
@@ -13,8 +26,38 @@ namespace sketch {
         /// @param hash_num Number of hash functions per level.
         /// @param seed Seed for generating hash functions.
         /// @param dataset Dataset to be tested.
+        /// @param real_ Built ground truth of the dataset, which must
+        ///              outlive the test.
+        /// @param thread_num_ Number of threads calculating ALE and APE,
+        ///                    0 for all cores.
+        /// @param timing_ Lock held while appending, so that appends of
+        ///                concurrent tests are timed one at a time, or
+        ///                nullptr.
+        /// @param sample_every_ Time one in this many appends and
+        ///                      queries on average, 0 for none.
+        SketchSingleTest(u64 mem_limit, u32 hash_num, u32 seed,
+                         const vector<FlowItem>& dataset,
+                         const real_dist& real_, u32 thread_num_ = 0,
+                         std::mutex* timing_ = nullptr,
+                         u32 sample_every_ = 0);
+
+        /// @brief Constructor consuming a stream chunk by chunk.
+        /// @param mem_limit Memory limit in bytes.
+        /// @param hash_num Number of hash functions per level.
+        /// @param seed Seed for generating hash functions.
+        /// @param stream Stream of the dataset to be tested.
+        /// @param real_ Built ground truth of the dataset, which must
+        ///              outlive the test.
+        /// @param thread_num_ Number of threads calculating ALE and APE,
+        ///                    0 for all cores.
+        /// @param timing_ Lock held while appending, or nullptr.
+        /// @param sample_every_ Time one in this many appends and
+        ///                      queries on average, 0 for none.
         SketchSingleTest(u64 mem_limit, u32 hash_num, u32 seed,
-                         const vector<FlowItem>& dataset);
+                         TraceStream& stream, const real_dist& real_,
+                         u32 thread_num_ = 0,
+                         std::mutex* timing_ = nullptr,
+                         u32 sample_every_ = 0);
 
         /// @brief Calculate ALE of a given model on a given flow type.
         inline f64 ALE(u32 model, u32 type) const;
@@ -22,25 +65,64 @@ namespace sketch {
         inline f64 APE(u32 model, u32 type) const;
         /// @brief Calculate appending throughput of a given model in Mops.
         inline f64 appendTp(u32 model) const;
+        /// @brief Return sampled append latencies of a given model.
+        inline const LatencyHistogram& appendLatency(u32 model) const;
+        /// @brief Return hardware event counts of appends of a given
+        ///        model.
+        inline const PerfCounts& appendPerf(u32 model) const;
         /// @brief Calculate query throughput of a given model in Mops.
-        inline f64 queryTp(u32 model) const;
+        /// @param latency Histogram to record sampled query latencies
+        ///                into, or nullptr.
+        /// @param counts Hardware event counts to add the queries to, or
+        ///               nullptr.
+        /// @note Counters are of the thread that constructed the test,
+        ///       which must be the calling one.
+        inline f64 queryTp(u32 model,
+                           LatencyHistogram* latency = nullptr,
+                           PerfCounts* counts = nullptr) const;
 
     private:
         M4<META> m4;    ///< M4 model.
         Strawman<META> straw;    ///< Strawman model.
-        real_dist real;             ///< Real distribution.
-
-        std::unordered_set<u32> id_list;    ///< List of flow id.
+        const real_dist& real;      ///< Real distribution, shared.
+        u32 thread_num;             ///< Threads calculating ALE and APE.
+        std::mutex* timing;         ///< Lock held while appending.
+        u32 sampleEvery;            ///< Mean gap between timed operations.
 
         f64 append_tp[NUM_MODELS];     ///< Appending throughput.
+        LatencyHistogram append_lat[NUM_MODELS];    ///< Append latency.
+        LatencySampler appendSampler[NUM_MODELS];   ///< Timed appends.
+        PerfCounts append_perf[NUM_MODELS];         ///< Append events.
+        /// Counters of the constructing thread, mutable as counting
+        /// queries does not change the test.
+        mutable PerfCounters perf;
+
+        /// @brief Reset the samplers of appends.
+        inline void initSamplers();
+
+        /// @brief Append items in [first, last) to all models.
+        /// @param append_us Appending time of each model in microseconds,
+        ///                  increased by the time taken.
+        inline void appendAll(const FlowItem* first, const FlowItem* last,
+                              f64 append_us[NUM_MODELS]);
 
         /// Given percentage, used when calculating ALE and APE.
         static constexpr f64 given_p = 0.5;
+        /// Number of flows per chunk of the parallel evaluation.
+        static constexpr u64 EVAL_GRAIN = 1024;
 
         /// @brief Return the type of a given flow.
         /// @param id Flow ID.
         inline FlowType getType(u32 id) const;
 
+        /// @brief Average the error of flows of a given type.
+        /// @details Flows are split into chunks evaluated on a
+        ///          work-stealing pool, each thread summing into its own
+        ///          accumulator, and the sums are reduced at the end.
+        /// @param flow_error Error of a flow given its ID.
+        template <typename F>
+        inline f64 meanError(u32 type, F flow_error) const;
+
         template <typename T>
         inline f64 ALE(const T& sketch, u32 type) const;
 
@@ -48,7 +130,8 @@ namespace sketch {
         inline f64 APE(const T& sketch, u32 type) const;
 
         template <typename T>
-        inline f64 queryTp(const T& sketch) const;
+        inline f64 queryTp(const T& sketch, LatencyHistogram* latency,
+                           PerfCounts* counts) const;
 
         template <typename T>
         inline f64 FlowALE(const T& sketch, u32 id) const;
@@ -64,16 +147,36 @@ namespace sketch {
         /// @param mem_limit_ Memory limit in bytes.
         /// @param hash_num_ Number of hash functions per level,
         ///                 used only by M4 model.
-        /// @param seed_ Seed for generating hash functions.
+        /// @param seed_ Seed for generating hash functions. Repetition
+        ///              0 uses it as is, the others derive their own.
         /// @param dataset_ Dataset to be tested.
         /// @param repeat_time_ Number of times to repeat the test.
+        /// @param streaming_ If the dataset is streamed from its file in
+        ///                   each repetition instead of being loaded
+        ///                   into memory once.
+        /// @param jobs_ Number of repetitions run at once, 0 for one per
+        ///              core. Each runs pinned to its own share of cores.
+        /// @param serial_timing_ If appends and query throughput of
+        ///                       concurrent repetitions are timed one at
+        ///                       a time.
+        /// @param sample_every_ Time one in this many appends and
+        ///                      queries on average, 0 for none.
         SketchTest(u64 mem_limit_, u32 hash_num_, u32 seed_,
                   const string& dataset_,
-                  u32 repeat_time_);
+                  u32 repeat_time_, bool streaming_ = false,
+                  u32 jobs_ = 1, bool serial_timing_ = false,
+                  u32 sample_every_ = 0);
 
         /// @brief Run the test.
         void run();
 
+        /// @brief Run the test on a dataset the caller loaded and its
+        ///        ground truth, e.g. shared by several tests.
+        /// @param dataset_loaded Loaded dataset, unused if streaming.
+        /// @param real Built ground truth of the dataset.
+        void run(const vector<FlowItem>& dataset_loaded,
+                 const real_dist& real);
+
         /// @brief Calculate ALE of a given model.
         f64 ALE(u32 model) const;
         /// @brief Calculate APE of a given model.
@@ -82,6 +185,18 @@ namespace sketch {
         f64 appendTp(u32 model) const;
         /// @brief Calculate query throughput of a given model in Mops.
         f64 queryTp(u32 model) const;
+        /// @brief Return sampled append latencies of a given model over
+        ///        all repetitions.
+        const LatencyHistogram& appendLatency(u32 model) const;
+        /// @brief Return sampled query latencies of a given model over
+        ///        all repetitions.
+        const LatencyHistogram& queryLatency(u32 model) const;
+        /// @brief Return hardware event counts of appends of a given
+        ///        model over all repetitions.
+        const PerfCounts& appendPerf(u32 model) const;
+        /// @brief Return hardware event counts of queries of a given
+        ///        model over all repetitions.
+        const PerfCounts& queryPerf(u32 model) const;
 
     private:
         u64 mem_limit;      ///< Memory limit.
@@ -89,11 +204,29 @@ namespace sketch {
         u32 seed;           ///< Seed for generating hash functions.
         string dataset;     ///< Dataset to be tested.
         u32 repeat;         ///< Number of times to repeat the test.
+        bool streaming;     ///< If the dataset is streamed.
+        u32 jobs;           ///< Number of repetitions run at once.
+        bool serialTiming;  ///< If timed phases run one at a time.
+        u32 sampleEvery;    ///< Mean gap between timed operations.
+
+        /// @brief Metrics of one repetition.
+        struct Metrics {
+            f64 ALE[NUM_MODELS], APE[NUM_MODELS];
+            f64 appendTp[NUM_MODELS], queryTp[NUM_MODELS];
+            LatencyHistogram appendLat[NUM_MODELS], queryLat[NUM_MODELS];
+            PerfCounts appendPerf[NUM_MODELS], queryPerf[NUM_MODELS];
+        };
 
         f64 m_ALE[NUM_MODELS], m_APE[NUM_MODELS];
         f64 m_appendTp[NUM_MODELS], m_queryTp[NUM_MODELS];
-
-        void addMetrics(const SketchSingleTest<META>& test);
+        LatencyHistogram m_appendLat[NUM_MODELS], m_queryLat[NUM_MODELS];
+        PerfCounts m_appendPerf[NUM_MODELS], m_queryPerf[NUM_MODELS];
+
+        /// @brief Calculate the metrics of a repetition.
+        /// @param timing Lock held while timing queries, or nullptr.
+        Metrics measure(const SketchSingleTest<META>& test,
+                        std::mutex* timing) const;
+        void addMetrics(const Metrics& metrics);
         void summarize();
     };
 }   // namespace sketch
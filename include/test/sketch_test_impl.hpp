@@ -1,38 +1,110 @@
 #pragma once
 #include "sketch_test.hpp"
+#include "../common/parallel.hpp"
+#include <atomic>
 #include <cmath>
+#include <exception>
 
 namespace sketch {
+    void prepare_dataset(const string& dataset, bool streaming,
+                         vector<FlowItem>& dataset_loaded, real_dist& real) {
+        if (streaming) {
+            auto stream = stream_dataset(dataset);
+            while (const auto* chunk = stream->next()) {
+                real.append(chunk->data(), chunk->data() + chunk->size());
+            }
+        } else {
+            dataset_loaded = load_dataset(dataset);
+            real.append(dataset_loaded.data(),
+                        dataset_loaded.data() + dataset_loaded.size());
+        }
+        real.build();
+    }
+
     template <typename META>
     SketchSingleTest<META>::SketchSingleTest(u64 mem_limit, u32 hash_num,
                                              u32 seed,
-                                             const vector<FlowItem>& dataset)
-        : m4(mem_limit, hash_num, seed), straw(mem_limit, seed) {
-        // append all items to real
-        for (auto [id, value] : dataset) {
-            real.append(id, value);
-            id_list.insert(id);
-        }
+                                             const vector<FlowItem>& dataset,
+                                             const real_dist& real_,
+                                             u32 thread_num_,
+                                             std::mutex* timing_,
+                                             u32 sample_every_)
+        : m4(mem_limit, hash_num, seed), straw(mem_limit, seed),
+          real(real_), thread_num(thread_num_), timing(timing_),
+          sampleEvery(sample_every_) {
+        initSamplers();
+        f64 append_us[NUM_MODELS] = {0};
+        appendAll(dataset.data(), dataset.data() + dataset.size(),
+                  append_us);
 
         f64 size = static_cast<f64>(dataset.size());
+        for (u32 i = 0; i < NUM_MODELS; ++i) {
+            append_tp[i] = size / append_us[i];
+        }
+    }
 
-        // append all items to m4 and calculate appending throughput
-        auto start = high_resolution_clock::now();
-        for (auto [id, value] : dataset) {
-            m4.append(id, value);
+    template <typename META>
+    SketchSingleTest<META>::SketchSingleTest(u64 mem_limit, u32 hash_num,
+                                             u32 seed, TraceStream& stream,
+                                             const real_dist& real_,
+                                             u32 thread_num_,
+                                             std::mutex* timing_,
+                                             u32 sample_every_)
+        : m4(mem_limit, hash_num, seed), straw(mem_limit, seed),
+          real(real_), thread_num(thread_num_), timing(timing_),
+          sampleEvery(sample_every_) {
+        initSamplers();
+        f64 append_us[NUM_MODELS] = {0};
+        f64 size = 0;
+        while (const auto* chunk = stream.next()) {
+            appendAll(chunk->data(), chunk->data() + chunk->size(),
+                      append_us);
+            size += chunk->size();
+        }
+
+        for (u32 i = 0; i < NUM_MODELS; ++i) {
+            append_tp[i] = size / append_us[i];
+        }
+    }
+
+    template <typename META>
+    void SketchSingleTest<META>::initSamplers() {
+        // the same seed for all models, which then time the same items
+        for (u32 i = 0; i < NUM_MODELS; ++i) {
+            appendSampler[i] = LatencySampler(sampleEvery);
+        }
+    }
+
+    template <typename META>
+    void SketchSingleTest<META>::appendAll(const FlowItem* first,
+                                           const FlowItem* last,
+                                           f64 append_us[NUM_MODELS]) {
+        std::unique_lock<std::mutex> guard;
+        if (timing) {
+            guard = std::unique_lock<std::mutex>(*timing);
         }
+
+        // append all items to m4 and measure appending time
+        perf.start();
+        auto start = high_resolution_clock::now();
+        run_sampled(last - first, [&](u64 i) {
+            m4.append(first[i].id, first[i].value);
+        }, appendSampler[M4MODEL], append_lat[M4MODEL]);
         auto end = high_resolution_clock::now();
-        auto duration = duration_cast<microseconds>(end - start);
-        append_tp[M4MODEL] = size / duration.count();
+        perf.stop(append_perf[M4MODEL], last - first);
+        append_us[M4MODEL] += duration_cast<nanoseconds>(end - start).count()
+                              / 1e3;
 
-        // append all items to straw and calculate appending throughput
+        // append all items to straw and measure appending time
+        perf.start();
         start = high_resolution_clock::now();
-        for (auto [id, value] : dataset) {
-            straw.append(id, value);
-        }
+        run_sampled(last - first, [&](u64 i) {
+            straw.append(first[i].id, first[i].value);
+        }, appendSampler[STRAW], append_lat[STRAW]);
         end = high_resolution_clock::now();
-        duration = duration_cast<microseconds>(end - start);
-        append_tp[STRAW] = size / duration.count();
+        perf.stop(append_perf[STRAW], last - first);
+        append_us[STRAW] += duration_cast<nanoseconds>(end - start).count()
+                            / 1e3;
     }
 
     template <typename META>
@@ -64,29 +136,68 @@ namespace sketch {
     }
 
     template <typename META>
-    f64 SketchSingleTest<META>::queryTp(u32 model) const {
+    const LatencyHistogram&
+    SketchSingleTest<META>::appendLatency(u32 model) const {
+        return append_lat[model];
+    }
+
+    template <typename META>
+    const PerfCounts& SketchSingleTest<META>::appendPerf(u32 model) const {
+        return append_perf[model];
+    }
+
+    template <typename META>
+    f64 SketchSingleTest<META>::queryTp(u32 model, LatencyHistogram* latency,
+                                        PerfCounts* counts) const {
         switch (model) {
-            case M4MODEL: return queryTp(m4);
-            case STRAW: return queryTp(straw);
+            case M4MODEL: return queryTp(m4, latency, counts);
+            case STRAW: return queryTp(straw, latency, counts);
         }
         throw std::invalid_argument("unknown DDSketch model");
     }
 
     template <typename META>
-    template <typename T>
-    f64 SketchSingleTest<META>::ALE(const T& sketch, u32 type) const {
-        u32 flow_cnt = 0;
-        f64 error = 0;
-        for (u32 id : id_list) {
-            if ((getType(id) & type) == 0) {
-                continue;
+    template <typename F>
+    f64 SketchSingleTest<META>::meanError(u32 type, F flow_error) const {
+        const vec_u32& flows = real.flows();
+        const u64 n = flows.size();
+        const u32 threads = detail::worker_count(
+            (n + EVAL_GRAIN - 1) / EVAL_GRAIN, thread_num);
+
+        // one accumulator per thread, each on its own cache line
+        struct alignas(64) Partial {
+            f64 error = 0;
+            u64 flow_cnt = 0;
+        };
+        vector<Partial> partial(threads);
+        detail::parallel_for(n, EVAL_GRAIN, threads,
+                             [&](u32 t, u64 first, u64 last) {
+            Partial& p = partial[t];
+            for (u64 i = first; i < last; ++i) {
+                const u32 id = flows[i];
+                if ((getType(id) & type) == 0) {
+                    continue;
+                }
+                p.error += flow_error(id);
+                ++p.flow_cnt;
             }
-            error += FlowALE(sketch, id);
-            ++flow_cnt;
+        });
+
+        f64 error = 0;
+        u64 flow_cnt = 0;
+        for (const Partial& p : partial) {
+            error += p.error;
+            flow_cnt += p.flow_cnt;
         }
         return error / flow_cnt;
     }
 
+    template <typename META>
+    template <typename T>
+    f64 SketchSingleTest<META>::ALE(const T& sketch, u32 type) const {
+        return meanError(type, [&](u32 id) { return FlowALE(sketch, id); });
+    }
+
     template <typename META>
     template <typename T>
     f64 SketchSingleTest<META>::FlowALE(const T& sketch, u32 id) const {
@@ -101,16 +212,7 @@ namespace sketch {
     template <typename META>
     template <typename T>
     f64 SketchSingleTest<META>::APE(const T& sketch, u32 type) const {
-        u32 flow_cnt = 0;
-        f64 error = 0;
-        for (u32 id : id_list) {
-            if ((getType(id) & type) == 0) {
-                continue;
-            }
-            error += FlowAPE(sketch, id);
-            ++flow_cnt;
-        }
-        return error / flow_cnt;
+        return meanError(type, [&](u32 id) { return FlowAPE(sketch, id); });
     }
 
     template <typename META>
@@ -126,21 +228,36 @@ namespace sketch {
 
     template <typename META>
     template <typename T>
-    f64 SketchSingleTest<META>::queryTp(const T& sketch) const {
+    f64 SketchSingleTest<META>::queryTp(const T& sketch,
+                                        LatencyHistogram* latency,
+                                        PerfCounts* counts) const {
         volatile u32 unused;    // just for avoiding optimization
         u32 flow_cnt = 0;
+        LatencySampler sampler(latency ? sampleEvery : 0);
+        perf.start();
         auto start = high_resolution_clock::now();
         for (u32 i = 0; i < 10; ++i) {
-            for (u32 id : id_list) {
+            for (u32 id : real.flows()) {
                 if (getType(id) == FlowType::TINY) {
                     continue;
                 }
-                unused = sketch.quantile(id, given_p);
+                if (sampler.due()) {
+                    auto op_start = steady_clock::now();
+                    unused = sketch.quantile(id, given_p);
+                    auto op_end = steady_clock::now();
+                    latency->record(duration_cast<nanoseconds>(
+                        op_end - op_start).count());
+                } else {
+                    unused = sketch.quantile(id, given_p);
+                }
                 (void) unused;
                 ++flow_cnt;
             }
         }
         auto end = high_resolution_clock::now();
+        if (counts) {
+            perf.stop(*counts, flow_cnt);
+        }
         auto duration = duration_cast<microseconds>(end - start);
         return static_cast<f64>(flow_cnt) / duration.count();
     }
@@ -148,35 +265,131 @@ namespace sketch {
     template <typename META>
     SketchTest<META>::SketchTest(u64 mem_limit_, u32 hash_num_, u32 seed_,
                          const string& dataset_name_,
-                         u32 repeat_)
+                         u32 repeat_, bool streaming_,
+                         u32 jobs_, bool serial_timing_,
+                         u32 sample_every_)
         : mem_limit(mem_limit_), hash_num(hash_num_), seed(seed_), 
-          dataset(dataset_name_), repeat(repeat_) { }
+          dataset(dataset_name_), repeat(repeat_), streaming(streaming_),
+          jobs(jobs_), serialTiming(serial_timing_),
+          sampleEvery(sample_every_) { }
 
     template <typename META>
     void SketchTest<META>::run() {
-        auto dataset_loaded = load_dataset(dataset);
+        // The dataset and its ground truth are the same for all
+        // repetitions, so they are built once and shared.
+        vector<FlowItem> dataset_loaded;
+        real_dist real;
+        prepare_dataset(dataset, streaming, dataset_loaded, real);
+        run(dataset_loaded, real);
+    }
 
+    template <typename META>
+    void SketchTest<META>::run(const vector<FlowItem>& dataset_loaded,
+                               const real_dist& real) {
         cout << "mem_limit: " << (mem_limit / 1024) << "KB" << endl;
-        
-        for (u32 i = 0; i < repeat; ++i) {
-            cout << "Running test " << i << "..." << endl;
-            SketchSingleTest<META> test(mem_limit, hash_num,
-                                        seed, dataset_loaded);
-            cout << "Calculating metrics..." << endl;
-            addMetrics(test);
+
+        // Each job takes its own share of cores, which its evaluation
+        // threads inherit, so timed loops of different jobs never share
+        // a core.
+        const u32 job_num = detail::worker_count(repeat, jobs);
+        const u32 core_num = detail::core_count();
+        const u32 share = std::max(1u, core_num / job_num);
+        std::mutex timing_mutex, print_mutex;
+        std::mutex* timing = serialTiming ? &timing_mutex : nullptr;
+
+        vector<Metrics> metrics(repeat);
+        vector<std::exception_ptr> errors(job_num);
+        std::atomic<u32> next{0};
+        detail::run_threads(job_num, [&](u32 job) {
+            if (job_num > 1
+                && !detail::pin_thread(job * share % core_num, share)) {
+                std::lock_guard<std::mutex> guard(print_mutex);
+                cerr << "warning: cannot pin job " << job
+                     << ", its timings may share cores" << endl;
+            }
+            try {
+                for (u32 i; (i = next++) < repeat; ) {
+                    const u32 run_seed = i == 0 ? seed
+                        : static_cast<u32>(derive_seed(seed, i));
+                    auto say = [&](const char* what) {
+                        std::lock_guard<std::mutex> guard(print_mutex);
+                        cout << what << " test " << i << "..." << endl;
+                    };
+                    say("Running");
+                    if (streaming) {
+                        auto stream = stream_dataset(dataset);
+                        SketchSingleTest<META> test(mem_limit, hash_num,
+                                                    run_seed, *stream, real,
+                                                    share, timing,
+                                                    sampleEvery);
+                        say("Calculating metrics of");
+                        metrics[i] = measure(test, timing);
+                    } else {
+                        SketchSingleTest<META> test(mem_limit, hash_num,
+                                                    run_seed, dataset_loaded,
+                                                    real, share, timing,
+                                                    sampleEvery);
+                        say("Calculating metrics of");
+                        metrics[i] = measure(test, timing);
+                    }
+                }
+            } catch (...) {
+                errors[job] = std::current_exception();
+            }
+        });
+        for (const auto& error : errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
         }
 
+        // in order of repetition, so results do not depend on timing
+        std::fill_n(m_ALE, NUM_MODELS, 0);
+        std::fill_n(m_APE, NUM_MODELS, 0);
+        std::fill_n(m_appendTp, NUM_MODELS, 0);
+        std::fill_n(m_queryTp, NUM_MODELS, 0);
+        for (u32 i = 0; i < NUM_MODELS; ++i) {
+            m_appendLat[i] = m_queryLat[i] = LatencyHistogram();
+            m_appendPerf[i] = m_queryPerf[i] = PerfCounts();
+        }
+        for (const Metrics& m : metrics) {
+            addMetrics(m);
+        }
         summarize();
         cout << "Test finished" << endl;
     }
 
     template <typename META>
-    void SketchTest<META>::addMetrics(const SketchSingleTest<META>& test) {
+    auto SketchTest<META>::measure(const SketchSingleTest<META>& test,
+                                   std::mutex* timing) const -> Metrics {
+        Metrics m;
+        for (u32 i = 0; i < NUM_MODELS; ++i) {
+            m.ALE[i] = test.ALE(i, MID | HUGE);
+            m.APE[i] = test.APE(i, MID | HUGE);
+            m.appendTp[i] = test.appendTp(i);
+            m.appendLat[i] = test.appendLatency(i);
+            m.appendPerf[i] = test.appendPerf(i);
+            std::unique_lock<std::mutex> guard;
+            if (timing) {
+                guard = std::unique_lock<std::mutex>(*timing);
+            }
+            m.queryTp[i] = test.queryTp(i, &m.queryLat[i],
+                                        &m.queryPerf[i]);
+        }
+        return m;
+    }
+
+    template <typename META>
+    void SketchTest<META>::addMetrics(const Metrics& metrics) {
         for (u32 i = 0; i < NUM_MODELS; ++i) {
-            m_ALE[i] += test.ALE(i, MID | HUGE);
-            m_APE[i] += test.APE(i, MID | HUGE);
-            m_appendTp[i] += test.appendTp(i);
-            m_queryTp[i] += test.queryTp(i);
+            m_ALE[i] += metrics.ALE[i];
+            m_APE[i] += metrics.APE[i];
+            m_appendTp[i] += metrics.appendTp[i];
+            m_queryTp[i] += metrics.queryTp[i];
+            m_appendLat[i].merge(metrics.appendLat[i]);
+            m_queryLat[i].merge(metrics.queryLat[i]);
+            m_appendPerf[i].merge(metrics.appendPerf[i]);
+            m_queryPerf[i].merge(metrics.queryPerf[i]);
         }
     }
 
@@ -209,4 +422,24 @@ namespace sketch {
     f64 SketchTest<META>::queryTp(u32 model) const {
         return m_queryTp[model];
     }
+
+    template <typename META>
+    const LatencyHistogram& SketchTest<META>::appendLatency(u32 model) const {
+        return m_appendLat[model];
+    }
+
+    template <typename META>
+    const LatencyHistogram& SketchTest<META>::queryLatency(u32 model) const {
+        return m_queryLat[model];
+    }
+
+    template <typename META>
+    const PerfCounts& SketchTest<META>::appendPerf(u32 model) const {
+        return m_appendPerf[model];
+    }
+
+    template <typename META>
+    const PerfCounts& SketchTest<META>::queryPerf(u32 model) const {
+        return m_queryPerf[model];
+    }
 }   // namespace sketch
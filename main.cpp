@@ -1,36 +1,84 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <sstream>
 #include <cassert>
+#include <algorithm>
 #include "include/test/sketch_test.hpp"
-#include "include/meta/dd/ddsketch.hpp"
-#include "include/meta/mreq/mreq_sketch.hpp"
-#include "include/meta/tdigest/tdigest.hpp"
+#include "include/test/sketch_sweep.hpp"
+#include "include/framework/framework_utils.hpp"
 
 using namespace sketch;
 
+// All binaries run every META, they differ only in those run by default.
 #if defined(TEST_MREQ)
-#define METATYPE mReqSketch
-#define metaname "mreq"
+#define default_metas "mreq"
 #elif defined(TEST_TD)
-#define METATYPE TDigest
-#define metaname "tdigest"
+#define default_metas "tdigest"
 #elif defined(TEST_DD)
-#define METATYPE DDSketch
-#define metaname "dd"
+#define default_metas "dd"
+#else
+#define default_metas "dd,mreq,tdigest"
 #endif
 
 void print_usage(char* file) {
     cout << "usage: " << file
-         << " <memory> <dataset> <hash-num> <repeat> [<seed>]" << endl;
+         << " <memory> <dataset> <hash-num> <repeat> [<seed>] [<mode>]"
+         << " [<jobs>] [<timing>]" << endl;
+    cout << "       [<sample>] [<metas>]" << endl;
+    cout << "       " << file << " sweep <memories> <dataset> <hash-nums>"
+         << " <repeat> [<metas>] [<seed>]" << endl;
+    cout << "       [<jobs>] [<format>]" << endl;
     cout << endl;
 
     cout << "Meaning of arguments: " << endl;
     cout << "    memory          memory in KB" << endl;
-    cout << "    dataset         caida, imc, or MAWI" << endl;
+    cout << "    dataset         caida, imc, MAWI, a capture as"
+         << " pcap:<file> to key" << endl;
+    cout << "                    flows by source IP, pcap5:<file> by"
+         << " 5-tuple, or" << endl;
+    cout << "                    synth[:<key>=<value>,...] for a synthetic"
+         << " trace with" << endl;
+    cout << "                    keys items, flows, skew (zipf, pareto),"
+         << " alpha," << endl;
+    cout << "                    dist (exp, lognormal, bimodal) and seed"
+         << endl;
     cout << "    hash-num        number of hash functions per level" << endl;
     cout << "    repeat          times of test repetitions" << endl;
     cout << "    seed            random seed, by default 0" << endl;
+    cout << "    mode            load, or stream to read the dataset in"
+         << " chunks" << endl;
+    cout << "                    instead of loading it, by default load"
+         << endl;
+    cout << "    jobs            repetitions run at once, each pinned to its"
+         << " own cores," << endl;
+    cout << "                    0 for one per core, by default 1" << endl;
+    cout << "    timing          pinned, or serial to time appends and"
+         << " queries of" << endl;
+    cout << "                    concurrent repetitions one at a time, by"
+         << " default pinned" << endl;
+    cout << "    sample          time one in this many appends and queries"
+         << " on average" << endl;
+    cout << "                    for latency percentiles, 0 for none, by"
+         << " default 1024" << endl;
+    cout << "    metas           comma-separated METAs among dd, mreq and"
+         << " tdigest, run" << endl;
+    cout << "                    on one loaded dataset, by default "
+         << default_metas << endl;
+    cout << endl;
+
+    cout << "Arguments of a sweep, which loads the dataset and builds its"
+         << " ground truth" << endl;
+    cout << "once for all configurations: " << endl;
+    cout << "    memories        comma-separated memories in KB" << endl;
+    cout << "    hash-nums       comma-separated numbers of hash functions"
+         << endl;
+    cout << "    metas           comma-separated METAs, by default "
+         << default_metas << endl;
+    cout << "    jobs            configurations run at once, each pinned to"
+         << " its own cores," << endl;
+    cout << "                    0 for one per core, by default 1" << endl;
+    cout << "    format          csv or json, by default csv" << endl;
 }
 
 struct main_args {
@@ -40,21 +88,45 @@ struct main_args {
     u32 hash_num;
     u32 repeat;
     u32 seed;
+    bool streaming;
+    u32 jobs;
+    bool serial_timing;
+    u32 sample_every;
+    vector<string> metas;
 };
 
+vector<string> split_list(const string& list) {
+    vector<string> items;
+    std::istringstream in(list);
+    for (string item; std::getline(in, item, ','); ) {
+        items.push_back(item);
+    }
+    return items;
+}
+
+/// @brief Return if METAs are known and given at most once each.
+bool valid_metas(const vector<string>& metas) {
+    for (u32 i = 0; i < metas.size(); ++i) {
+        if (!visit_meta(metas[i], [](auto) { })
+            || std::count(metas.begin(), metas.begin() + i, metas[i])) {
+            return false;
+        }
+    }
+    return !metas.empty();
+}
+
 main_args parse_args(int argc, char* argv[]) {
     main_args args;
     args.valid = false;
 
-    if (argc != 5 && argc != 6) {
+    if (argc < 5 || argc > 11) {
         return args;
     }
 
     args.memory = stoul(argv[1]) * 1024;
 
     args.dataset = argv[2];
-    if (args.dataset != "caida" && args.dataset != "imc" &&
-        args.dataset != "MAWI") {
+    if (!valid_dataset(args.dataset)) {
         return args;
     }
 
@@ -63,18 +135,151 @@ main_args parse_args(int argc, char* argv[]) {
     args.repeat = stoul(argv[4]);
 
     args.seed = 0;
-    if (argc == 6) {
+    if (argc >= 6) {
         args.seed = stoul(argv[5]);
     }
 
-    args.valid = true;
+    args.streaming = false;
+    if (argc >= 7) {
+        string mode = argv[6];
+        if (mode != "load" && mode != "stream") {
+            return args;
+        }
+        args.streaming = mode == "stream";
+    }
+
+    args.jobs = 1;
+    if (argc >= 8) {
+        args.jobs = stoul(argv[7]);
+    }
+
+    args.serial_timing = false;
+    if (argc >= 9) {
+        string timing = argv[8];
+        if (timing != "pinned" && timing != "serial") {
+            return args;
+        }
+        args.serial_timing = timing == "serial";
+    }
+
+    args.sample_every = 1024;
+    if (argc >= 10) {
+        args.sample_every = stoul(argv[9]);
+    }
+
+    args.metas = split_list(default_metas);
+    if (argc == 11) {
+        args.metas = split_list(argv[10]);
+    }
+
+    args.valid = valid_metas(args.metas);
     return args;
 }
 
+struct sweep_args {
+    bool valid;
+    vector<u64> memories;
+    string dataset;
+    vector<u32> hash_nums;
+    u32 repeat;
+    vector<string> metas;
+    u32 seed;
+    u32 jobs;
+    string format;
+};
+
+sweep_args parse_sweep_args(int argc, char* argv[]) {
+    sweep_args args;
+    args.valid = false;
+
+    if (argc < 6 || argc > 10) {
+        return args;
+    }
+
+    for (const string& kb : split_list(argv[2])) {
+        args.memories.push_back(stoull(kb) * 1024);
+    }
+
+    args.dataset = argv[3];
+    if (!valid_dataset(args.dataset)) {
+        return args;
+    }
+
+    for (const string& num : split_list(argv[4])) {
+        args.hash_nums.push_back(stoul(num));
+    }
 
-void output_res(const main_args& args, const SketchTest<METATYPE>& test) {
-    string output_name = static_cast<string>(res_path) + "res_" + metaname
-                            + "_" + args.dataset + ".txt";
+    args.repeat = stoul(argv[5]);
+
+    args.metas = split_list(default_metas);
+    if (argc >= 7) {
+        args.metas = split_list(argv[6]);
+    }
+
+    args.seed = 0;
+    if (argc >= 8) {
+        args.seed = stoul(argv[7]);
+    }
+
+    args.jobs = 1;
+    if (argc >= 9) {
+        args.jobs = stoul(argv[8]);
+    }
+
+    args.format = "csv";
+    if (argc == 10) {
+        args.format = argv[9];
+        if (args.format != "csv" && args.format != "json") {
+            return args;
+        }
+    }
+
+    args.valid = !args.memories.empty() && !args.hash_nums.empty()
+                 && valid_metas(args.metas);
+    return args;
+}
+
+void output_latency(ofstream& out, const string& what,
+                    const LatencyHistogram& latency) {
+    if (latency.count() == 0) {
+        return;
+    }
+    out << what << ": p50 " << latency.percentile(50)
+        << " ns, p99 " << latency.percentile(99)
+        << " ns, p99.9 " << latency.percentile(99.9)
+        << " ns, max " << latency.max() << " ns, "
+        << latency.count() << " samples" << endl;
+}
+
+void output_perf(ofstream& out, const string& what, const PerfCounts& counts) {
+    bool any = false;
+    for (u32 e = 0; e < NUM_PERF_EVENTS; ++e) {
+        any = any || counts.counted(e);
+    }
+    if (!any) {
+        return;
+    }
+    out << what << " per op:";
+    for (u32 e = 0; e < NUM_PERF_EVENTS; ++e) {
+        out << (e == 0 ? " " : ", ") << perf_event_name(e) << " ";
+        if (counts.counted(e)) {
+            out << counts.perOp(e);
+        } else {
+            out << "n/a";
+        }
+    }
+    if (counts.counted(PERF_CYCLES) && counts.counted(PERF_INSTRUCTIONS)) {
+        out << ", IPC " << counts.perOp(PERF_INSTRUCTIONS)
+                           / counts.perOp(PERF_CYCLES);
+    }
+    out << endl;
+}
+
+template <typename META>
+void output_res(const main_args& args, const SketchTest<META>& test) {
+    string output_name = static_cast<string>(res_path) + "res_"
+                            + MetaTraits<META>::name
+                            + "_" + dataset_label(args.dataset) + ".txt";
     ofstream out(output_name, ios::app);
     assert(out.is_open());
 
@@ -93,23 +298,82 @@ void output_res(const main_args& args, const SketchTest<METATYPE>& test) {
     out << "AppendTp of Strawman: " << test.appendTp(STRAW) << " Mops" << endl;
     out << "QueryTp of M4: " << test.queryTp(M4MODEL) << " Mops" << endl;
     out << "QueryTp of Strawman: " << test.queryTp(STRAW) << " Mops" << endl;
+    output_latency(out, "Append latency of M4", test.appendLatency(M4MODEL));
+    output_latency(out, "Append latency of Strawman",
+                   test.appendLatency(STRAW));
+    output_latency(out, "Query latency of M4", test.queryLatency(M4MODEL));
+    output_latency(out, "Query latency of Strawman",
+                   test.queryLatency(STRAW));
+    PerfCounters probe;
+    if (probe.available()) {
+        output_perf(out, "Append events of M4", test.appendPerf(M4MODEL));
+        output_perf(out, "Append events of Strawman", test.appendPerf(STRAW));
+        output_perf(out, "Query events of M4", test.queryPerf(M4MODEL));
+        output_perf(out, "Query events of Strawman", test.queryPerf(STRAW));
+    } else {
+        out << "Hardware counters unavailable: " << probe.error() << endl;
+    }
     out << endl;
 }
 
+void run_sweep(const sweep_args& args) {
+    SketchSweep sweep(args.dataset, args.repeat, args.seed, args.jobs);
+    string metas;
+    for (const string& meta : args.metas) {
+        visit_meta(meta, [&](auto tag) {
+            using META = typename decltype(tag)::type;
+            sweep.add<META>(meta, args.memories, args.hash_nums);
+        });
+        metas += (metas.empty() ? "" : "-") + meta;
+    }
+    sweep.run();
+
+    string output_name = static_cast<string>(res_path) + "sweep_" + metas
+                            + "_" + dataset_label(args.dataset) + "."
+                            + args.format;
+    ofstream out(output_name);
+    assert(out.is_open());
+    if (args.format == "json") {
+        sweep.writeJSON(out);
+    } else {
+        sweep.writeCSV(out);
+    }
+}
+
 int main(int argc, char* argv[]) {
+    if (argc >= 2 && string(argv[1]) == "sweep") {
+        sweep_args args = parse_sweep_args(argc, argv);
+        if (!args.valid) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        run_sweep(args);
+        return 0;
+    }
+
     main_args args = parse_args(argc, argv);
     if (!args.valid) {
         print_usage(argv[0]);
         return 1;
     }
 
-    SketchTest<METATYPE> test(args.memory, args.hash_num, args.seed, 
-                   args.dataset, args.repeat);
+    // the METAs share the dataset and its ground truth
+    vector<FlowItem> dataset_loaded;
+    real_dist real;
+    prepare_dataset(args.dataset, args.streaming, dataset_loaded, real);
 
-    test.run();
-
-    output_res(args, test);
+    for (const string& meta : args.metas) {
+        visit_meta(meta, [&](auto tag) {
+            using META = typename decltype(tag)::type;
+            cout << "META: " << meta << endl;
+            SketchTest<META> test(args.memory, args.hash_num, args.seed,
+                                  args.dataset, args.repeat, args.streaming,
+                                  args.jobs, args.serial_timing,
+                                  args.sample_every);
+            test.run(dataset_loaded, real);
+            output_res(args, test);
+        });
+    }
 }
 
-#undef METATYPE
-#undef metaname
+#undef default_metas